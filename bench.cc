@@ -0,0 +1,416 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <getopt.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "buffer.h"
+#include "format.h"
+#include "ippacket.h"
+#include "match.h"
+#include "pacer.h"
+#include "packet.h"
+#include "resolve.h"
+#include "token.h"
+
+/* Microbenchmarks for the core primitives.  Each benchmark is calibrated
+ * to run for about --time seconds, then timed over several runs; the
+ * median ns/op is reported along with heap allocations and bytes per
+ * op, counted by wrapping malloc.  Benchmarks that scan a payload also
+ * report throughput in Gbps.  The process is pinned to one CPU and the
+ * inputs are fixed, so numbers are comparable between builds. */
+
+extern "C" {
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t n);
+
+static unsigned long alloc_count, alloc_bytes;
+
+void *malloc(size_t n) {
+	alloc_count++;
+	alloc_bytes += n;
+	return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+	alloc_count++;
+	alloc_bytes += n * size;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+	alloc_count++;
+	alloc_bytes += n;
+	return __libc_realloc(p, n);
+}
+}
+
+#define RUNS 5
+
+struct Bench {
+	const char *name;
+	void (*run)(long iters);
+	int bytes;  /* payload bytes per op, for throughput; 0 if none */
+};
+
+/* fixtures */
+static Packet *tcp_packet, *udp_packet, *icmp_packet;
+static Buffer tcp_frame, udp_frame, icmp_frame;
+static Buffer data_1500, data_9000;
+static Buffer http_1500;
+static Matcher *match_4, *match_1000, *match_5000;
+static char spec_file[64];
+static int spec_packets;
+static FILE *devnull;
+static Formatter *text_out, *json_out, *csv_out;
+
+/* keeps the compiler from dropping a result */
+static volatile unsigned long sink;
+
+static const char tcp_spec[] =
+	"IP( protocol=tcp source=10.0.0.1 destination=10.0.0.2 identification=7\n"
+	"  payload=TCP( sport=1234 dport=80 seq=1000 ack=2000 flags=PSH|ACK\n"
+	"    window=8192 data=(000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f) ) )\n";
+static const char udp_spec[] =
+	"IP( protocol=udp source=10.0.0.1 destination=10.0.0.2\n"
+	"  payload=UDP( sport=5353 dport=53 data=(000102030405060708090a0b0c0d0e0f"
+	"101112131415161718191a1b1c1d1e1f) ) )\n";
+static const char icmp_spec[] =
+	"IP( protocol=icmp source=10.0.0.1 destination=10.0.0.2\n"
+	"  payload=ICMP( message=echo_request data=(0001020304050607) ) )\n";
+
+/* n signatures of 8 to 15 lowercase letters and digits, made up the same
+ * way every time */
+static Matcher *make_matcher(int n) {
+	Matcher *m = new Matcher;
+	unsigned int x = 12345;
+	for (int i=0; i<n; i++) {
+		unsigned char sig[16];
+		x = x * 1103515245 + 12345;
+		int len = 8 + (x >> 16) % 8;
+		for (int j=0; j<len; j++) {
+			x = x * 1103515245 + 12345;
+			sig[j] = "abcdefghijklmnopqrstuvwxyz0123456789"[(x >> 16) % 36];
+		}
+		char name[16];
+		sprintf(name, "sig%d", i);
+		m->add(name, sig, len);
+	}
+	if (!m->compile()) exit(1);
+	return m;
+}
+
+static Packet *parse_string(const char *spec) {
+	FILE *fp = fmemopen((void*)spec, strlen(spec), "r");
+	Packet *p = parse(fp);
+	fclose(fp);
+	if (!p) {
+		fprintf(stderr, "bench: bad built-in spec\n");
+		exit(1);
+	}
+	p->prepare();
+	return p;
+}
+
+static void setup(void) {
+	tcp_packet = parse_string(tcp_spec);
+	udp_packet = parse_string(udp_spec);
+	icmp_packet = parse_string(icmp_spec);
+	tcp_frame = tcp_packet->to_buffer();
+	udp_frame = udp_packet->to_buffer();
+	icmp_frame = icmp_packet->to_buffer();
+
+	data_1500 = Buffer(1500);
+	data_9000 = Buffer(9000);
+	for (int i=0; i<9000; i++) {
+		if (i < 1500) data_1500.data[i] = i * 7;
+		data_9000.data[i] = i * 13;
+	}
+
+	/* HTTP-looking text for the matcher to scan */
+	static const char http[] = "GET /index.html?q=packet HTTP/1.1\r\n"
+		"Host: www.example.com\r\nUser-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+		"Accept: text/html,application/xhtml+xml;q=0.9,*/*;q=0.8\r\n"
+		"Cookie: session=0123456789abcdef; theme=dark\r\n\r\n";
+	http_1500 = Buffer(1500);
+	for (int i=0; i<1500; i++)
+		http_1500.data[i] = http[i % (sizeof(http) - 1)];
+	/* the four start with bytes that are rare in the text, so the
+	 * prefilter can skip */
+	match_4 = new Matcher;
+	match_4->add("a", (const unsigned char *)"QQQQ", 4);
+	match_4->add("b", (const unsigned char *)"ZZZZZ", 5);
+	match_4->add("c", (const unsigned char *)"\x90\x90\x90", 3);
+	match_4->add("d", (const unsigned char *)"\x7f" "ELF", 4);
+	match_4->compile();
+	match_1000 = make_matcher(1000);
+	match_5000 = make_matcher(5000);
+
+	/* a spec file of the three packets, repeated */
+	strcpy(spec_file, "/tmp/pkbenchXXXXXX");
+	int fd = mkstemp(spec_file);
+	FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+	if (!fp) {
+		perror("bench: spec file");
+		exit(1);
+	}
+	for (spec_packets=0; spec_packets<3000; spec_packets += 3)
+		fprintf(fp, "%s%s%s", tcp_spec, udp_spec, icmp_spec);
+	fclose(fp);
+
+	devnull = fopen("/dev/null", "w");
+	text_out = new Formatter(FORMAT_TEXT);
+	json_out = new Formatter(FORMAT_JSON);
+	csv_out = new Formatter(FORMAT_CSV);
+}
+
+static void bench_decode(const Buffer &frame, long iters) {
+	for (long i=0; i<iters; i++) {
+		IPPacket p(frame);
+		sink += p.len;
+	}
+}
+static void decode_tcp(long iters) { bench_decode(tcp_frame, iters); }
+static void decode_udp(long iters) { bench_decode(udp_frame, iters); }
+static void decode_icmp(long iters) { bench_decode(icmp_frame, iters); }
+
+static void bench_encode(const Packet *p, long iters) {
+	for (long i=0; i<iters; i++) {
+		Buffer b = p->to_buffer();
+		sink += b.length;
+	}
+}
+static void encode_tcp(long iters) { bench_encode(tcp_packet, iters); }
+static void encode_udp(long iters) { bench_encode(udp_packet, iters); }
+static void encode_icmp(long iters) { bench_encode(icmp_packet, iters); }
+
+static void prepare_tcp(long iters) {
+	for (long i=0; i<iters; i++) tcp_packet->prepare();
+}
+static void prepare_udp(long iters) {
+	for (long i=0; i<iters; i++) udp_packet->prepare();
+}
+
+static void bench_checksum(const unsigned char *data, int len, long iters) {
+	Buffer b(data, len);
+	for (long i=0; i<iters; i++)
+		sink += calculate_checksum(b);
+}
+static void checksum_20(long iters) { bench_checksum(data_1500.data, 20, iters); }
+static void checksum_64(long iters) { bench_checksum(data_1500.data, 64, iters); }
+static void checksum_576(long iters) { bench_checksum(data_1500.data, 576, iters); }
+static void checksum_1500(long iters) { bench_checksum(data_1500.data, 1500, iters); }
+static void checksum_9000(long iters) { bench_checksum(data_9000.data, 9000, iters); }
+
+/* per packet parsed: iters is rounded to whole passes over the file */
+static void parse_spec(long iters) {
+	for (long done=0; done<iters; ) {
+		SpecFile sf(spec_file);
+		Packet *p;
+		while (done < iters && (p = parse(sf))) {
+			delete p;
+			done++;
+		}
+	}
+}
+
+static void parse_stdio(long iters) {
+	for (long done=0; done<iters; ) {
+		FILE *fp = fopen(spec_file, "r");
+		Packet *p;
+		while (done < iters && (p = parse(fp))) {
+			delete p;
+			done++;
+		}
+		fclose(fp);
+	}
+}
+
+static void print_tcp(long iters) {
+	for (long i=0; i<iters; i++) tcp_packet->print(devnull);
+}
+
+static void bench_format(Formatter *f, long iters) {
+	for (long i=0; i<iters; i++) {
+		tcp_packet->format(*f);
+		f->end_record();
+		if (f->length() > 65536) f->reset();
+	}
+	f->reset();
+}
+static void format_text(long iters) { bench_format(text_out, iters); }
+static void format_json(long iters) { bench_format(json_out, iters); }
+static void format_csv(long iters) { bench_format(csv_out, iters); }
+
+static void bench_match(Matcher *m, bool prefilter, long iters) {
+	bool was = m->prefilter;
+	m->prefilter = m->prefilter && prefilter;
+	for (long i=0; i<iters; i++)
+		sink += m->scan(http_1500.data, http_1500.length);
+	m->prefilter = was;
+}
+static void match4(long iters) { bench_match(match_4, true, iters); }
+static void match4_noskip(long iters) { bench_match(match_4, false, iters); }
+static void match1000(long iters) { bench_match(match_1000, true, iters); }
+static void match5000(long iters) { bench_match(match_5000, true, iters); }
+
+static const Bench benches[] = {
+	{ "decode/tcp", decode_tcp },
+	{ "decode/udp", decode_udp },
+	{ "decode/icmp", decode_icmp },
+	{ "encode/tcp", encode_tcp },
+	{ "encode/udp", encode_udp },
+	{ "encode/icmp", encode_icmp },
+	{ "prepare/tcp", prepare_tcp },
+	{ "prepare/udp", prepare_udp },
+	{ "checksum/20", checksum_20 },
+	{ "checksum/64", checksum_64 },
+	{ "checksum/576", checksum_576 },
+	{ "checksum/1500", checksum_1500 },
+	{ "checksum/9000", checksum_9000 },
+	{ "parse/specfile", parse_spec },
+	{ "parse/stdio", parse_stdio },
+	{ "print/tcp", print_tcp },
+	{ "format/text", format_text },
+	{ "format/json", format_json },
+	{ "format/csv", format_csv },
+	{ "match/4", match4, 1500 },
+	{ "match/4-noskip", match4_noskip, 1500 },
+	{ "match/1000", match1000, 1500 },
+	{ "match/5000", match5000, 1500 },
+	{ NULL, NULL }
+};
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] [name prefix ...]\n"
+		"  -t, --time=SECS   time per run (default 0.2)\n"
+		"  -j, --json=FILE   also write results as JSON lines to FILE\n"
+		"  -l, --list        list the benchmarks\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "time", required_argument, NULL, 't' },
+		{ "json", required_argument, NULL, 'j' },
+		{ "list", no_argument, NULL, 'l' },
+		{ NULL, 0, NULL, 0 }
+	};
+	double target = 0.2;
+	FILE *json = NULL;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "t:j:l", long_options, NULL)) != -1) {
+		switch (c) {
+			case 't':
+				target = atof(optarg);
+				if (target <= 0) usage(argv[0]);
+				break;
+			case 'j':
+				if (!(json = fopen(optarg, "w"))) {
+					perror(optarg);
+					exit(1);
+				}
+				break;
+			case 'l':
+				for (int i=0; benches[i].name; i++)
+					printf("%s\n", benches[i].name);
+				return 0;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu() >= 0 ? sched_getcpu() : 0, &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+	resolve_init(false);
+	setup();
+
+	printf("%-16s %12s %8s %12s %12s %8s %8s\n", "benchmark", "iters", "ns/op",
+		"allocs/op", "bytes/op", "spread", "Gbps");
+	for (int i=0; benches[i].name; i++) {
+		const Bench *b = &benches[i];
+		bool wanted = optind == argc;
+		for (int a=optind; a<argc; a++)
+			if (!strncmp(b->name, argv[a], strlen(argv[a]))) wanted = true;
+		if (!wanted) continue;
+
+		/* calibrate: double until a run takes 10ms, then scale to target */
+		long iters = 1;
+		nsec_t t;
+		for (;;) {
+			t = monotonic_ns();
+			b->run(iters);
+			t = monotonic_ns() - t;
+			if (t >= 10000000 || iters >= (1L << 40)) break;
+			iters *= 2;
+		}
+		iters = (long)(iters * (target * 1e9 / t));
+		if (iters < 1) iters = 1;
+
+		double ns[RUNS];
+		unsigned long allocs = 0, bytes = 0;
+		for (int r=0; r<RUNS; r++) {
+			unsigned long a0 = alloc_count, b0 = alloc_bytes;
+			t = monotonic_ns();
+			b->run(iters);
+			t = monotonic_ns() - t;
+			ns[r] = (double)t / iters;
+			allocs = alloc_count - a0;
+			bytes = alloc_bytes - b0;
+		}
+		qsort(ns, RUNS, sizeof(double), compare_doubles);
+		double median = ns[RUNS/2];
+		double spread = median > 0 ? 100.0 * (ns[RUNS-1] - ns[0]) / median : 0;
+		double allocs_op = (double)allocs / iters, bytes_op = (double)bytes / iters;
+		double gbps = b->bytes && median > 0 ? b->bytes * 8 / median : 0;
+		printf("%-16s %12ld %8.1f %12.2f %12.1f %7.1f%%", b->name, iters, median,
+			allocs_op, bytes_op, spread);
+		if (b->bytes) printf(" %8.2f", gbps);
+		printf("\n");
+		fflush(stdout);
+		if (json) {
+			fprintf(json, "{\"name\":\"%s\",\"iters\":%ld,\"ns_per_op\":%.2f,"
+				"\"min_ns_per_op\":%.2f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f,",
+				b->name, iters, median, ns[0], allocs_op, bytes_op);
+			if (b->bytes) fprintf(json, "\"gbps\":%.3f,", gbps);
+			fprintf(json, "\"runs\":%d}\n", RUNS);
+		}
+	}
+	if (json) fclose(json);
+	unlink(spec_file);
+	return 0;
+}
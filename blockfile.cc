@@ -0,0 +1,362 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <zstd.h>
+#include "blockfile.h"
+
+#define FILE_MAGIC "PKZCAP1\n"
+#define DIR_MAGIC "PKZDIR1\n"
+#define FILE_HEADER 16
+#define BLOCK_HEADER 32
+#define DIR_ENTRY 40
+#define FOOTER 24
+
+static void put_block_header(unsigned char *p, const BlockInfo &b) {
+	unsigned int u[4] = { b.clen, b.rlen, b.records, 0 };
+	memcpy(p, u, 16);
+	memcpy(p+16, &b.min_ts, 8);
+	memcpy(p+24, &b.max_ts, 8);
+}
+
+static void get_block_header(const unsigned char *p, BlockInfo *b) {
+	unsigned int u[4];
+	memcpy(u, p, 16);
+	b->clen = u[0];
+	b->rlen = u[1];
+	b->records = u[2];
+	memcpy(&b->min_ts, p+16, 8);
+	memcpy(&b->max_ts, p+24, 8);
+}
+
+BlockWriter::BlockWriter(const char *filename, int linktype, int snaplen,
+		int level) {
+	records = 0;
+	raw_bytes = bytes = 0;
+	this->level = level;
+	this->snaplen = snaplen < 65535 ? snaplen : 65535;
+	cur = queue = queue_tail = free_list = NULL;
+	blocks_out = 0;
+	closing = false;
+	dir = NULL;
+	nblocks = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	pthread_cond_init(&done, NULL);
+	if (!(fp = fopen(filename, "w"))) {
+		perror(filename);
+		return;
+	}
+	unsigned int header[2] = { (unsigned int)linktype, (unsigned int)snaplen };
+	fwrite(FILE_MAGIC, 1, 8, fp);
+	fwrite(header, 1, 8, fp);
+	bytes = FILE_HEADER;
+	if (pthread_create(&thread, NULL, compress_thread, this)) {
+		perror("pthread_create");
+		fclose(fp);
+		fp = NULL;
+	}
+}
+
+BlockWriter::~BlockWriter(void) {
+	if (fp) close();
+	while (free_list) {
+		Block *b = free_list;
+		free_list = b->next;
+		g_free(b->data);
+		g_free(b);
+	}
+	g_free(dir);
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&wake);
+	pthread_cond_destroy(&done);
+}
+
+void BlockWriter::write(long long ts, const unsigned char *data, int caplen,
+		int len) {
+	if (!fp) return;
+	if (caplen > snaplen) caplen = snaplen;
+	if (!cur) {
+		pthread_mutex_lock(&lock);
+		while (!free_list && blocks_out >= BLOCK_QUEUE)
+			pthread_cond_wait(&done, &lock);
+		if (free_list) {
+			cur = free_list;
+			free_list = cur->next;
+		}
+		else {
+			cur = g_new(Block, 1);
+			cur->data = g_new(unsigned char, BLOCK_RAW_MAX);
+		}
+		blocks_out++;
+		pthread_mutex_unlock(&lock);
+		cur->used = 0;
+		cur->records = 0;
+		cur->min_ts = cur->max_ts = ts;
+	}
+	unsigned int header[4] = { (unsigned int)(ts / 1000000000LL),
+		(unsigned int)(ts % 1000000000LL), (unsigned int)caplen, (unsigned int)len };
+	memcpy(cur->data + cur->used, header, 16);
+	memcpy(cur->data + cur->used + 16, data, caplen);
+	cur->used += 16 + caplen;
+	cur->records++;
+	if (ts < cur->min_ts) cur->min_ts = ts;
+	if (ts > cur->max_ts) cur->max_ts = ts;
+	records++;
+	raw_bytes += 16 + caplen;
+	if (cur->used >= BLOCK_RAW_SIZE) submit();
+}
+
+void BlockWriter::submit(void) {
+	if (!cur) return;
+	cur->next = NULL;
+	pthread_mutex_lock(&lock);
+	if (queue_tail)
+		queue_tail->next = cur;
+	else
+		queue = cur;
+	queue_tail = cur;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	cur = NULL;
+}
+
+void *BlockWriter::compress_thread(void *arg) {
+	BlockWriter *w = (BlockWriter*)arg;
+	size_t cap = ZSTD_compressBound(BLOCK_RAW_MAX);
+	unsigned char *out = g_new(unsigned char, BLOCK_HEADER + cap);
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (!w->queue && !w->closing)
+			pthread_cond_wait(&w->wake, &w->lock);
+		Block *b = w->queue;
+		if (b) {
+			w->queue = b->next;
+			if (!w->queue) w->queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&w->lock);
+		if (!b) break;  /* closing, and nothing left */
+
+		size_t clen = ZSTD_compress(out + BLOCK_HEADER, cap, b->data, b->used,
+			w->level);
+		if (ZSTD_isError(clen)) {
+			g_warning("BlockWriter: %s", ZSTD_getErrorName(clen));
+			clen = 0;
+		}
+		BlockInfo info;
+		info.offset = w->bytes;
+		info.clen = clen;
+		info.rlen = b->used;
+		info.records = b->records;
+		info.min_ts = b->min_ts;
+		info.max_ts = b->max_ts;
+		if (clen > 0) {
+			put_block_header(out, info);
+			if (fwrite(out, 1, BLOCK_HEADER + clen, w->fp) != BLOCK_HEADER + clen)
+				perror("BlockWriter: write");
+			w->dir = g_renew(BlockInfo, w->dir, w->nblocks+1);
+			w->dir[w->nblocks++] = info;
+			w->bytes += BLOCK_HEADER + clen;
+		}
+
+		pthread_mutex_lock(&w->lock);
+		b->next = w->free_list;
+		w->free_list = b;
+		w->blocks_out--;
+		pthread_cond_signal(&w->done);
+		pthread_mutex_unlock(&w->lock);
+	}
+	g_free(out);
+	return NULL;
+}
+
+void BlockWriter::close(void) {
+	if (!fp) return;
+	submit();
+	pthread_mutex_lock(&lock);
+	closing = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	long long dir_offset = bytes;
+	for (int i=0; i<nblocks; i++) {
+		unsigned char entry[DIR_ENTRY];
+		memcpy(entry, &dir[i].offset, 8);
+		put_block_header(entry+8, dir[i]);
+		fwrite(entry, 1, DIR_ENTRY, fp);
+	}
+	unsigned int counts[2] = { (unsigned int)nblocks, 0 };
+	fwrite(&dir_offset, 1, 8, fp);
+	fwrite(counts, 1, 8, fp);
+	fwrite(DIR_MAGIC, 1, 8, fp);
+	bytes += nblocks * DIR_ENTRY + FOOTER;
+	if (fclose(fp)) perror("BlockWriter: close");
+	fp = NULL;
+}
+
+bool is_block_file(const char *filename) {
+	char magic[8];
+	FILE *fp = fopen(filename, "r");
+	bool ret = fp && fread(magic, 1, 8, fp) == 8 && !memcmp(magic, FILE_MAGIC, 8);
+	if (fp) fclose(fp);
+	return ret;
+}
+
+BlockReader::BlockReader(const char *filename) {
+	struct stat st;
+	int fd;
+
+	base = NULL;
+	size = 0;
+	dir = NULL;
+	nblocks = 0;
+	linktype = snaplen = 0;
+	raw = NULL;
+	cur_block = -1;
+	raw_len = raw_pos = 0;
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		perror(filename);
+		return;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < FILE_HEADER) {
+		g_warning("%s: not a compressed capture", filename);
+		close(fd);
+		return;
+	}
+	size = st.st_size;
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(filename);
+		return;
+	}
+	if (memcmp(p, FILE_MAGIC, 8)) {
+		g_warning("%s: not a compressed capture", filename);
+		munmap(p, size);
+		return;
+	}
+	base = (const unsigned char*)p;
+	unsigned int header[2];
+	memcpy(header, base+8, 8);
+	linktype = header[0];
+	snaplen = header[1];
+
+	/* the directory, if the writer got as far as writing one */
+	long long dir_offset;
+	unsigned int counts[2];
+	if (size >= FILE_HEADER + FOOTER
+			&& !memcmp(base + size - 8, DIR_MAGIC, 8)) {
+		memcpy(&dir_offset, base + size - FOOTER, 8);
+		memcpy(counts, base + size - 16, 8);
+		if (dir_offset >= FILE_HEADER
+				&& (size_t)dir_offset + (size_t)counts[0] * DIR_ENTRY + FOOTER == size) {
+			nblocks = counts[0];
+			dir = g_new(BlockInfo, nblocks + 1);
+			int i;
+			for (i=0; i<nblocks; i++) {
+				const unsigned char *e = base + dir_offset + i * DIR_ENTRY;
+				memcpy(&dir[i].offset, e, 8);
+				get_block_header(e+8, &dir[i]);
+				/* held to the same limits as the scan below */
+				if (dir[i].offset < FILE_HEADER || dir[i].rlen > BLOCK_RAW_MAX
+						|| dir[i].offset + BLOCK_HEADER + (long long)dir[i].clen
+							> dir_offset)
+					break;
+			}
+			if (i == nblocks) return;
+			g_warning("%s: bad entry %d in block directory", filename, i);
+			g_free(dir);
+			dir = NULL;
+			nblocks = 0;
+		}
+	}
+
+	/* otherwise, walk the blocks */
+	g_warning("%s: no block directory; scanning", filename);
+	size_t pos = FILE_HEADER;
+	while (pos + BLOCK_HEADER <= size) {
+		BlockInfo b;
+		get_block_header(base + pos, &b);
+		if (b.clen == 0 || b.rlen > BLOCK_RAW_MAX
+				|| pos + BLOCK_HEADER + b.clen > size)
+			break;
+		b.offset = pos;
+		dir = g_renew(BlockInfo, dir, nblocks+1);
+		dir[nblocks++] = b;
+		pos += BLOCK_HEADER + b.clen;
+	}
+}
+
+BlockReader::~BlockReader(void) {
+	if (base) munmap((void*)base, size);
+	g_free(dir);
+	g_free(raw);
+}
+
+bool BlockReader::load(int i, unsigned char *out) const {
+	if (i < 0 || i >= nblocks) return false;
+	const BlockInfo &b = dir[i];
+	size_t n = ZSTD_decompress(out, BLOCK_RAW_MAX, base + b.offset + BLOCK_HEADER,
+		b.clen);
+	if (ZSTD_isError(n) || n != b.rlen) {
+		g_warning("compressed capture: bad block %d", i);
+		return false;
+	}
+	return true;
+}
+
+bool BlockReader::next(PcapRecord *rec) {
+	if (!base) return false;
+	if (!raw) raw = g_new(unsigned char, BLOCK_RAW_MAX);
+	while (cur_block < 0 || !block_record(raw, raw_len, &raw_pos, rec)) {
+		if (++cur_block >= nblocks) {
+			cur_block = nblocks - 1;
+			raw_pos = raw_len;
+			return false;
+		}
+		raw_pos = 0;
+		raw_len = load(cur_block, raw) ? dir[cur_block].rlen : 0;
+	}
+	return true;
+}
+
+bool block_record(const unsigned char *raw, int len, int *pos,
+		PcapRecord *rec) {
+	unsigned int header[4];
+	if (*pos + 16 > len) return false;
+	memcpy(header, raw + *pos, 16);
+	if (header[2] > (unsigned int)(len - *pos - 16)) return false;
+	rec->ts = (long long)header[0] * 1000000000LL + header[1];
+	rec->caplen = header[2];
+	rec->len = header[3];
+	rec->data = raw + *pos + 16;
+	*pos += 16 + header[2];
+	return true;
+}
@@ -0,0 +1,130 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "pcap.h"
+
+/* A block-compressed capture file.  Records are pcap records (16-byte
+ * header and frame, host byte order); they are gathered into blocks of
+ * about BLOCK_RAW_SIZE bytes, each compressed on its own with zstd, so a
+ * reader can start at any block and decompress blocks in parallel.
+ *
+ *   header     "PKZCAP1\n", u32 linktype, u32 snaplen
+ *   blocks     each a 32-byte header, then the compressed bytes:
+ *                u32 compressed length, u32 raw length,
+ *                u32 records, u32 reserved, i64 min_ts, i64 max_ts
+ *   directory  one 40-byte entry per block: u64 file offset of the block
+ *              header, then the block header fields as above
+ *   footer     u64 directory offset, u32 blocks, u32 reserved,
+ *              "PKZDIR1\n"
+ *
+ * A file whose writer never finished has no directory; the reader then
+ * walks the block headers instead, up to the last complete block. */
+
+#define BLOCK_RAW_SIZE (1 << 20)
+#define BLOCK_RAW_MAX (BLOCK_RAW_SIZE + 16 + 65536)  /* one record over */
+
+struct BlockInfo {
+	long long offset;  /* of the block header */
+	unsigned int clen, rlen, records;
+	long long min_ts, max_ts;
+};
+
+/* Compression and writing happen on a background thread: write() only
+ * copies the record into the block being filled.  If the disk falls more
+ * than BLOCK_QUEUE blocks behind, write() waits. */
+#define BLOCK_QUEUE 64
+
+class BlockWriter {
+public:
+	BlockWriter(const char *filename, int linktype, int snaplen = 65535,
+		int level = 3);
+	~BlockWriter(void);
+	bool ok(void) const { return fp != NULL; }
+	void write(long long ts, const unsigned char *data, int caplen, int len);
+	void close(void);  /* drain the queue, write the directory */
+
+	unsigned long records;
+	long long raw_bytes, bytes;  /* bytes: as written so far */
+
+private:
+	struct Block {
+		unsigned char *data;
+		int used;
+		unsigned int records;
+		long long min_ts, max_ts;
+		Block *next;
+	};
+	static void *compress_thread(void *arg);
+	void submit(void);
+
+	FILE *fp;
+	int level, snaplen;
+	Block *cur;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	Block *queue, *queue_tail, *free_list;
+	int blocks_out;  /* allocated and not on free_list */
+	bool closing;
+	BlockInfo *dir;
+	int nblocks;
+};
+
+class BlockReader {
+public:
+	BlockReader(const char *filename);
+	~BlockReader(void);
+	bool ok(void) const { return base != NULL; }
+	int count(void) const { return nblocks; }
+	const BlockInfo &block(int i) const { return dir[i]; }
+	/* decompress block i into raw, BLOCK_RAW_MAX bytes long; safe to call
+	 * from several threads at once */
+	bool load(int i, unsigned char *raw) const;
+	/* sequential reading, through an internal buffer */
+	bool next(PcapRecord *rec);
+	void rewind(void) { cur_block = -1; }
+
+	int linktype, snaplen;
+
+private:
+	const unsigned char *base;
+	size_t size;
+	BlockInfo *dir;
+	int nblocks;
+
+	unsigned char *raw;
+	int cur_block, raw_len, raw_pos;
+};
+
+bool is_block_file(const char *filename);
+/* walk the records of a decompressed block; *pos starts at 0 */
+bool block_record(const unsigned char *raw, int len, int *pos,
+	PcapRecord *rec);
+
+#endif
@@ -0,0 +1,197 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "capindex.h"
+
+#define INDEX_MAGIC "PKIDX01\n"
+#define INDEX_HEADER 12
+#define ENTRY_HEADER 40
+#define ENTRY_SIZE (ENTRY_HEADER + INDEX_BLOOM_BYTES)
+
+enum { KEY_ADDR = 1, KEY_PORT = 2 };
+
+static unsigned long long index_key(int kind, unsigned int value) {
+	unsigned long long x = ((unsigned long long)kind << 32) | value;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* double hashing: probe i is h1 + i*h2 */
+static void bloom_add(unsigned char *bloom, unsigned long long h) {
+	unsigned int h1 = h, h2 = (h >> 32) | 1;
+	for (int i=0; i<INDEX_HASHES; i++, h1 += h2) {
+		unsigned int bit = h1 % (INDEX_BLOOM_BYTES * 8);
+		bloom[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+static bool bloom_test(const unsigned char *bloom, unsigned long long h) {
+	unsigned int h1 = h, h2 = (h >> 32) | 1;
+	for (int i=0; i<INDEX_HASHES; i++, h1 += h2) {
+		unsigned int bit = h1 % (INDEX_BLOOM_BYTES * 8);
+		if (!(bloom[bit >> 3] & (1 << (bit & 7)))) return false;
+	}
+	return true;
+}
+
+IndexWriter::IndexWriter(const char *filename) {
+	blocks = 0;
+	memset(&cur, 0, sizeof(cur));
+	memset(bloom, 0, sizeof(bloom));
+	if (!(fp = fopen(filename, "w"))) {
+		perror(filename);
+		return;
+	}
+	unsigned int bloom_bytes = INDEX_BLOOM_BYTES;
+	fwrite(INDEX_MAGIC, 1, 8, fp);
+	fwrite(&bloom_bytes, 1, 4, fp);
+	fflush(fp);
+}
+
+IndexWriter::~IndexWriter(void) {
+	close_block();
+	if (fp) fclose(fp);
+}
+
+bool IndexWriter::add(const PcapRecord &rec, long offset, int linktype) {
+	if (cur.records == 0) {
+		cur.offset = offset;
+		cur.min_ts = cur.max_ts = rec.ts;
+	}
+	if (rec.ts < cur.min_ts) cur.min_ts = rec.ts;
+	if (rec.ts > cur.max_ts) cur.max_ts = rec.ts;
+	cur.length = offset + 16 + rec.caplen - cur.offset;
+	cur.records++;
+
+	int len;
+	FlowKey k;
+	const unsigned char *ip = frame_ip(rec.data, rec.caplen, linktype, &len);
+	if (ip && ip_flow(ip, len, &k)) {
+		bloom_add(bloom, index_key(KEY_ADDR, k.src.s_addr));
+		bloom_add(bloom, index_key(KEY_ADDR, k.dst.s_addr));
+		if (k.sport || k.dport) {
+			bloom_add(bloom, index_key(KEY_PORT, k.sport));
+			bloom_add(bloom, index_key(KEY_PORT, k.dport));
+		}
+	}
+	return cur.length >= INDEX_BLOCK_BYTES || cur.records >= INDEX_BLOCK_RECORDS;
+}
+
+/* The caller flushes the pcap file first, so that an entry never
+ * describes data that isn't on disk yet. */
+void IndexWriter::close_block(void) {
+	if (!fp || cur.records == 0) return;
+	long long header[5];
+	header[0] = cur.offset;
+	header[1] = cur.length;
+	unsigned int counts[2] = { cur.records, 0 };
+	memcpy(&header[2], counts, 8);
+	header[3] = cur.min_ts;
+	header[4] = cur.max_ts;
+	fwrite(header, 1, ENTRY_HEADER, fp);
+	fwrite(bloom, 1, INDEX_BLOOM_BYTES, fp);
+	fflush(fp);
+	blocks++;
+	cur.records = 0;
+	memset(bloom, 0, sizeof(bloom));
+}
+
+IndexReader::IndexReader(const char *filename) {
+	struct stat st;
+	int fd;
+
+	base = NULL;
+	size = 0;
+	nblocks = 0;
+	if ((fd = open(filename, O_RDONLY)) < 0) return;
+	if (fstat(fd, &st) < 0 || st.st_size < INDEX_HEADER) {
+		close(fd);
+		return;
+	}
+	size = st.st_size;
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(filename);
+		return;
+	}
+	unsigned int bloom_bytes;
+	memcpy(&bloom_bytes, (char*)p + 8, 4);
+	if (memcmp(p, INDEX_MAGIC, 8) || bloom_bytes != INDEX_BLOOM_BYTES) {
+		g_warning("%s: not an index file, or from another version", filename);
+		munmap(p, size);
+		return;
+	}
+	base = (const unsigned char*)p;
+	/* a partly written last entry is ignored */
+	nblocks = (size - INDEX_HEADER) / ENTRY_SIZE;
+}
+
+IndexReader::~IndexReader(void) {
+	if (base) munmap((void*)base, size);
+}
+
+void IndexReader::get(int i, IndexBlock *b) const {
+	const unsigned char *p = base + INDEX_HEADER + (size_t)i * ENTRY_SIZE;
+	long long header[5];
+	memcpy(header, p, ENTRY_HEADER);
+	b->offset = header[0];
+	b->length = header[1];
+	memcpy(&b->records, &header[2], 4);
+	b->min_ts = header[3];
+	b->max_ts = header[4];
+	b->bloom = p + ENTRY_HEADER;
+}
+
+bool IndexReader::may_match(const IndexBlock &b, const IndexQuery &q) const {
+	if (b.max_ts < q.from || b.min_ts > q.to) return false;
+	for (int i=0; i<q.naddrs; i++)
+		if (!bloom_test(b.bloom, index_key(KEY_ADDR, q.addrs[i].s_addr)))
+			return false;
+	for (int i=0; i<q.nports; i++)
+		if (!bloom_test(b.bloom, index_key(KEY_PORT, q.ports[i])))
+			return false;
+	return true;
+}
+
+bool query_match(const IndexQuery &q, long long ts, const FlowKey *k) {
+	if (ts < q.from || ts > q.to) return false;
+	if (!k) return q.naddrs == 0 && q.nports == 0;
+	for (int i=0; i<q.naddrs; i++)
+		if (k->src.s_addr != q.addrs[i].s_addr && k->dst.s_addr != q.addrs[i].s_addr)
+			return false;
+	for (int i=0; i<q.nports; i++)
+		if (k->sport != q.ports[i] && k->dport != q.ports[i])
+			return false;
+	return true;
+}
@@ -0,0 +1,103 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef CAPINDEX_H
+#define CAPINDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include "pcap.h"
+
+/* A sidecar index for a pcap file, conventionally <file>.idx.  The
+ * capture is cut into blocks of consecutive records; for each block the
+ * index keeps its byte range, its time range, and a Bloom filter over
+ * the addresses and ports seen in it.  A query reads only the blocks
+ * whose time range overlaps and whose filter may hold every address and
+ * port asked for.
+ *
+ * The file is an 8-byte magic, "PKIDX01\n", then a u32 holding
+ * INDEX_BLOOM_BYTES, then fixed-size entries in host byte order (like the
+ * pcap file they describe), appended as each block closes:
+ *   i64 offset, length   of the block's records in the pcap file
+ *   u32 records, reserved
+ *   i64 min_ts, max_ts   nanoseconds since the epoch
+ *   Bloom filter, INDEX_BLOOM_BYTES long, INDEX_HASHES probes per key */
+
+#define INDEX_BLOCK_BYTES (8 << 20)
+#define INDEX_BLOCK_RECORDS 4096
+#define INDEX_BLOOM_BYTES 16384
+#define INDEX_HASHES 4
+
+struct IndexBlock {
+	long long offset, length;
+	unsigned int records;
+	long long min_ts, max_ts;
+	const unsigned char *bloom;
+};
+
+class IndexWriter {
+public:
+	IndexWriter(const char *filename);
+	~IndexWriter(void);
+	bool ok(void) const { return fp != NULL; }
+	/* rec was written at 'offset' in the pcap file.  Returns true once the
+	 * block is full: flush the pcap file, then call close_block(). */
+	bool add(const PcapRecord &rec, long offset, int linktype);
+	void close_block(void);
+
+	unsigned long blocks;
+
+private:
+	FILE *fp;
+	IndexBlock cur;
+	unsigned char bloom[INDEX_BLOOM_BYTES];
+};
+
+/* What to look for: a time range, and addresses and ports that must
+ * each appear on a packet as either source or destination. */
+struct IndexQuery {
+	long long from, to;
+	int naddrs, nports;
+	struct in_addr addrs[2];
+	int ports[2];
+};
+
+class IndexReader {
+public:
+	IndexReader(const char *filename);
+	~IndexReader(void);
+	bool ok(void) const { return base != NULL; }
+	int count(void) const { return nblocks; }
+	void get(int i, IndexBlock *b) const;
+	bool may_match(const IndexBlock &b, const IndexQuery &q) const;
+
+private:
+	const unsigned char *base;
+	size_t size;
+	int nblocks;
+};
+
+/* exact test of one record; k is NULL if it isn't IPv4 */
+bool query_match(const IndexQuery &q, long long ts, const FlowKey *k);
+
+#endif
@@ -0,0 +1,401 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "columnar.h"
+#include "ippacket.h"
+#include "tcppacket.h"
+#include "udppacket.h"
+
+#define COLUMN_MAGIC "PKCOL01\n"
+#define CHUNK_HEADER 32
+#define COLUMN_HEADER 8
+#define MAX_DICT 256
+
+static const struct {
+	int width;
+	size_t offset;
+} column_map[NCOLUMNS] = {
+	{ 8, offsetof(ColumnChunk, ts) },
+	{ 4, offsetof(ColumnChunk, src) },
+	{ 4, offsetof(ColumnChunk, dst) },
+	{ 1, offsetof(ColumnChunk, protocol) },
+	{ 2, offsetof(ColumnChunk, sport) },
+	{ 2, offsetof(ColumnChunk, dport) },
+	{ 1, offsetof(ColumnChunk, flags) },
+	{ 2, offsetof(ColumnChunk, length) },
+	{ 1, offsetof(ColumnChunk, ttl) },
+};
+
+static void *column_array(const ColumnChunk *c, int id) {
+	return *(void**)((char*)c + column_map[id].offset);
+}
+
+static unsigned long long get_value(const void *a, int width, int i) {
+	switch (width) {
+		case 1: return ((const unsigned char*)a)[i];
+		case 2: return ((const unsigned short*)a)[i];
+		case 4: return ((const unsigned int*)a)[i];
+		default: return ((const unsigned long long*)a)[i];
+	}
+}
+
+static void set_value(void *a, int width, int i, unsigned long long v) {
+	switch (width) {
+		case 1: ((unsigned char*)a)[i] = v; break;
+		case 2: ((unsigned short*)a)[i] = v; break;
+		case 4: ((unsigned int*)a)[i] = v; break;
+		default: ((unsigned long long*)a)[i] = v; break;
+	}
+}
+
+static unsigned char *put_le(unsigned char *p, unsigned long long v, int width) {
+	for (int i=0; i<width; i++, v >>= 8)
+		*p++ = v & 0xFF;
+	return p;
+}
+
+static unsigned long long get_le(const unsigned char *p, int width) {
+	unsigned long long v = 0;
+	for (int i=width-1; i>=0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+/* zigzag, so that small negative differences stay short too */
+static unsigned char *put_varint(unsigned char *p, long long d) {
+	unsigned long long v = ((unsigned long long)d << 1) ^ (d >> 63);
+	while (v >= 0x80) {
+		*p++ = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static int varint_length(long long d) {
+	unsigned long long v = ((unsigned long long)d << 1) ^ (d >> 63);
+	int n = 1;
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+void column_chunk_init(ColumnChunk *c) {
+	c->rows = 0;
+	for (int id=0; id<NCOLUMNS; id++)
+		*(void**)((char*)c + column_map[id].offset) =
+			g_malloc(COLUMN_CHUNK_ROWS * column_map[id].width);
+}
+
+void column_chunk_free(ColumnChunk *c) {
+	for (int id=0; id<NCOLUMNS; id++)
+		g_free(column_array(c, id));
+}
+
+ColumnWriter::ColumnWriter(const char *filename) {
+	rows = bytes = 0;
+	column_chunk_init(&chunk);
+	/* worst case: every column delta-encoded at ten bytes a row */
+	out = g_new(unsigned char, CHUNK_HEADER
+		+ NCOLUMNS * (COLUMN_HEADER + 8 + 10 * COLUMN_CHUNK_ROWS));
+	used = 0;
+	if (!(fp = fopen(filename, "w"))) {
+		perror(filename);
+		return;
+	}
+	fwrite(COLUMN_MAGIC, 1, 8, fp);
+	bytes = 8;
+}
+
+ColumnWriter::~ColumnWriter(void) {
+	flush();
+	if (fp) fclose(fp);
+	column_chunk_free(&chunk);
+	g_free(out);
+}
+
+void ColumnWriter::add(long long ts, const IPPacket &ip) {
+	int i = chunk.rows;
+	chunk.ts[i] = ts;
+	chunk.src[i] = ip.src.s_addr;
+	chunk.dst[i] = ip.dst.s_addr;
+	chunk.protocol[i] = ip.protocol;
+	chunk.length[i] = ip.len;
+	chunk.ttl[i] = ip.ttl;
+	chunk.sport[i] = chunk.dport[i] = chunk.flags[i] = 0;
+	if (ip.payload && ip.protocol == IP_TCP) {
+		TCPPacket *tcp = (TCPPacket*)ip.payload;
+		chunk.sport[i] = tcp->sport;
+		chunk.dport[i] = tcp->dport;
+		chunk.flags[i] = tcp->flags;
+	}
+	else if (ip.payload && ip.protocol == IP_UDP) {
+		UDPPacket *udp = (UDPPacket*)ip.payload;
+		chunk.sport[i] = udp->sport;
+		chunk.dport[i] = udp->dport;
+	}
+	rows++;
+	if (++chunk.rows == COLUMN_CHUNK_ROWS) flush();
+}
+
+/* Appends one column to the chunk being built, in whichever encoding
+ * comes out smallest. */
+void ColumnWriter::encode(int id) {
+	int width = column_map[id].width, n = chunk.rows;
+	const void *a = column_array(&chunk, id);
+
+	/* dictionary: up to MAX_DICT distinct values, found by linear probing */
+	unsigned long long dict[MAX_DICT];
+	unsigned char index[COLUMN_CHUNK_ROWS];
+	int slot[2*MAX_DICT], ndict = 0;
+	memset(slot, 0xFF, sizeof(slot));
+	for (int i=0; i<n && ndict <= MAX_DICT; i++) {
+		unsigned long long v = get_value(a, width, i);
+		unsigned int h = (unsigned int)((v * 0x9E3779B97F4A7C15ULL) >> 55);
+		while (slot[h] >= 0 && dict[slot[h]] != v)
+			h = (h + 1) & (2*MAX_DICT - 1);
+		if (slot[h] < 0) {
+			if (ndict == MAX_DICT) {
+				ndict++;
+				break;
+			}
+			slot[h] = ndict;
+			dict[ndict++] = v;
+		}
+		index[i] = slot[h];
+	}
+	int dict_size = ndict <= MAX_DICT ? 2 + ndict*width + n : -1;
+
+	int delta_size = width;
+	for (int i=1; i<n; i++)
+		delta_size += varint_length(get_value(a, width, i) - get_value(a, width, i-1));
+
+	int plain_size = n * width;
+
+	unsigned char *p = out + used + COLUMN_HEADER, *start = p;
+	int enc;
+	if (dict_size >= 0 && dict_size < plain_size && dict_size <= delta_size) {
+		enc = ENC_DICT;
+		p = put_le(p, ndict, 2);
+		for (int i=0; i<ndict; i++)
+			p = put_le(p, dict[i], width);
+		memcpy(p, index, n);
+		p += n;
+	}
+	else if (n > 0 && delta_size < plain_size) {
+		enc = ENC_DELTA;
+		p = put_le(p, get_value(a, width, 0), width);
+		for (int i=1; i<n; i++)
+			p = put_varint(p, get_value(a, width, i) - get_value(a, width, i-1));
+	}
+	else {
+		enc = ENC_PLAIN;
+		if (G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+			memcpy(p, a, n * width);
+			p += n * width;
+		}
+		else
+			for (int i=0; i<n; i++)
+				p = put_le(p, get_value(a, width, i), width);
+	}
+
+	unsigned char *h = out + used;
+	h[0] = id;
+	h[1] = enc;
+	h[2] = width;
+	h[3] = 0;
+	put_le(h+4, p - start, 4);
+	while ((p - start) % 8)
+		*p++ = 0;
+	used = p - out;
+}
+
+void ColumnWriter::flush(void) {
+	if (!fp || chunk.rows == 0) return;
+	long long min_ts = chunk.ts[0], max_ts = chunk.ts[0];
+	for (int i=1; i<chunk.rows; i++) {
+		if (chunk.ts[i] < min_ts) min_ts = chunk.ts[i];
+		if (chunk.ts[i] > max_ts) max_ts = chunk.ts[i];
+	}
+	used = CHUNK_HEADER;
+	for (int id=0; id<NCOLUMNS; id++)
+		encode(id);
+	unsigned char *p = out;
+	p = put_le(p, used, 4);
+	p = put_le(p, chunk.rows, 4);
+	p = put_le(p, NCOLUMNS, 4);
+	p = put_le(p, 0, 4);
+	p = put_le(p, min_ts, 8);
+	p = put_le(p, max_ts, 8);
+	if (fwrite(out, 1, used, fp) != (size_t)used)
+		perror("ColumnWriter: write");
+	fflush(fp);
+	bytes += used;
+	chunk.rows = 0;
+}
+
+ColumnReader::ColumnReader(const char *filename) {
+	struct stat st;
+	int fd;
+
+	base = pos = limit = NULL;
+	size = 0;
+	min_ts = max_ts = 0;
+	column_chunk_init(&chunk);
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		perror(filename);
+		return;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < 8) {
+		g_warning("%s: not a columnar file", filename);
+		close(fd);
+		return;
+	}
+	size = st.st_size;
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(filename);
+		return;
+	}
+	if (memcmp(p, COLUMN_MAGIC, 8)) {
+		g_warning("%s: not a columnar file", filename);
+		munmap(p, size);
+		return;
+	}
+	madvise(p, size, MADV_SEQUENTIAL);
+	base = (const unsigned char*)p;
+	pos = base + 8;
+	limit = base + size;
+}
+
+ColumnReader::~ColumnReader(void) {
+	if (base) munmap((void*)base, size);
+	column_chunk_free(&chunk);
+}
+
+bool ColumnReader::decode(const unsigned char *p, int id, int enc,
+		int width, int len) {
+	int n = chunk.rows;
+	void *a = column_array(&chunk, id);
+	if (width != column_map[id].width) return false;
+	switch (enc) {
+		case ENC_PLAIN:
+			if (len < n * width) return false;
+			if (width == 1 || G_BYTE_ORDER == G_LITTLE_ENDIAN)
+				memcpy(a, p, n * width);
+			else
+				for (int i=0; i<n; i++, p += width)
+					set_value(a, width, i, get_le(p, width));
+			return true;
+		case ENC_DELTA: {
+			const unsigned char *end = p + len;
+			if (n == 0) return true;
+			if (len < width) return false;
+			unsigned long long v = get_le(p, width);
+			p += width;
+			set_value(a, width, 0, v);
+			for (int i=1; i<n; i++) {
+				unsigned long long z = 0;
+				int shift = 0;
+				do {
+					if (p >= end || shift > 63) return false;
+					z |= (unsigned long long)(*p & 0x7F) << shift;
+					shift += 7;
+				} while (*p++ & 0x80);
+				v += (long long)(z >> 1) ^ -(long long)(z & 1);
+				set_value(a, width, i, v);
+			}
+			return true;
+		}
+		case ENC_DICT: {
+			if (len < 2) return false;
+			int ndict = get_le(p, 2);
+			if (ndict > MAX_DICT || len < 2 + ndict*width + n) return false;
+			unsigned long long dict[MAX_DICT];
+			for (int i=0; i<ndict; i++)
+				dict[i] = get_le(p + 2 + i*width, width);
+			p += 2 + ndict*width;
+			for (int i=0; i<n; i++) {
+				if (p[i] >= ndict) return false;
+				set_value(a, width, i, dict[p[i]]);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ColumnReader::next(unsigned int mask) {
+	if (!base || pos + CHUNK_HEADER > limit) return false;
+	unsigned int chunk_bytes = get_le(pos, 4);
+	int rows = get_le(pos+4, 4), ncols = get_le(pos+8, 4);
+	if (chunk_bytes < CHUNK_HEADER || pos + chunk_bytes > limit
+			|| rows < 0 || rows > COLUMN_CHUNK_ROWS || ncols < 0) {
+		g_warning("columnar: bad chunk at offset %ld", (long)(pos - base));
+		pos = limit;
+		return false;
+	}
+	chunk.rows = rows;
+	min_ts = get_le(pos+16, 8);
+	max_ts = get_le(pos+24, 8);
+
+	/* every requested column must be decoded afresh: the arrays still
+	 * hold the last chunk's values for any that isn't */
+	const unsigned char *p = pos + CHUNK_HEADER, *end = pos + chunk_bytes;
+	unsigned int want = mask & ((1U << NCOLUMNS) - 1), got = 0;
+	for (int c=0; c<ncols; c++) {
+		if (p + COLUMN_HEADER > end
+				|| get_le(p+4, 4) > (unsigned int)(end - p - COLUMN_HEADER)) {
+			g_warning("columnar: truncated column at offset %ld", (long)(p - base));
+			pos = limit;
+			return false;
+		}
+		int id = p[0], enc = p[1], width = p[2];
+		unsigned int len = get_le(p+4, 4);
+		if (id < NCOLUMNS && (want & (1U << id))) {
+			if (!decode(p + COLUMN_HEADER, id, enc, width, len)) {
+				g_warning("columnar: bad column %d at offset %ld", id, (long)(p - base));
+				pos = limit;
+				return false;
+			}
+			got |= 1U << id;
+		}
+		p += COLUMN_HEADER + ((len + 7) & ~7U);
+	}
+	if (got != want) {
+		g_warning("columnar: chunk at offset %ld lacks a column", (long)(pos - base));
+		pos = limit;
+		return false;
+	}
+	pos += chunk_bytes;
+	return true;
+}
@@ -0,0 +1,124 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+class IPPacket;
+
+/* Columnar header export.  A file is an 8-byte magic, "PKCOL01\n",
+ * followed by chunks of up to COLUMN_CHUNK_ROWS packets.  All integers
+ * are little-endian.
+ *
+ *   chunk header (32 bytes)
+ *     u32 bytes       whole chunk, this header included
+ *     u32 rows
+ *     u32 columns     number of column blocks that follow
+ *     u32 reserved
+ *     i64 min_ts, max_ts
+ *   column block, one per column
+ *     u8  id          COL_* below
+ *     u8  encoding    ENC_* below
+ *     u8  width       bytes per value: 1, 2, 4 or 8
+ *     u8  reserved
+ *     u32 bytes       of the data that follows, before padding
+ *     data, padded with zeros to a multiple of 8 bytes
+ *
+ * Encodings:
+ *   ENC_PLAIN  rows values, each width bytes
+ *   ENC_DELTA  the first value (width bytes), then rows-1 differences
+ *              from the previous value as zigzag LEB128 varints
+ *   ENC_DICT   u16 count (at most 256), count values of width bytes,
+ *              then one u8 index into them per row
+ *
+ * Timestamps are nanoseconds since the epoch; addresses are in network
+ * order, as struct in_addr holds them.  Ports and TCP flags are zero for
+ * protocols that don't have them.  A reader skips column ids it doesn't
+ * know, so columns may be added later. */
+
+#define COLUMN_CHUNK_ROWS 65536
+
+enum { COL_TS, COL_SRC, COL_DST, COL_PROTOCOL, COL_SPORT, COL_DPORT,
+	COL_FLAGS, COL_LENGTH, COL_TTL, NCOLUMNS };
+enum { ENC_PLAIN, ENC_DELTA, ENC_DICT };
+
+/* One chunk of decoded columns, each an array of 'rows' values. */
+struct ColumnChunk {
+	int rows;
+	long long *ts;
+	unsigned int *src, *dst;
+	unsigned char *protocol;
+	unsigned short *sport, *dport;
+	unsigned char *flags;
+	unsigned short *length;
+	unsigned char *ttl;
+};
+
+class ColumnWriter {
+public:
+	ColumnWriter(const char *filename);
+	~ColumnWriter(void);
+	bool ok(void) const { return fp != NULL; }
+	void add(long long ts, const IPPacket &ip);
+	void flush(void);  /* write out a partial chunk */
+
+	unsigned long rows, bytes;
+
+private:
+	void encode(int id);
+
+	FILE *fp;
+	ColumnChunk chunk;
+	unsigned char *out;
+	int used;
+};
+
+/* Reads a columnar file through a read-only mapping.  next() decodes the
+ * following chunk; only the columns in 'mask' (bits 1<<COL_*) are
+ * decoded, the rest are skipped without being touched.  A chunk missing
+ * a column in 'mask', or with one cut short, is corrupt: next() warns
+ * and stops there. */
+class ColumnReader {
+public:
+	ColumnReader(const char *filename);
+	~ColumnReader(void);
+	bool ok(void) const { return base != NULL; }
+	bool next(unsigned int mask = ~0U);
+	void rewind(void) { pos = base + 8; }
+
+	ColumnChunk chunk;
+	long long min_ts, max_ts;  /* of the current chunk */
+
+private:
+	bool decode(const unsigned char *p, int id, int enc, int width, int len);
+
+	const unsigned char *base, *pos, *limit;
+	size_t size;
+};
+
+void column_chunk_init(ColumnChunk *c);
+void column_chunk_free(ColumnChunk *c);
+
+#endif
@@ -0,0 +1,212 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "counters.h"
+#include "ether.h"
+
+static const char *protocol_names[NCOUNT_PROTOS] = {
+	"tcp", "udp", "icmp", "other"
+};
+static const char *flag_names[COUNT_FLAGS] = {
+	"fin", "syn", "rst", "psh", "ack", "urg", "ece", "cwr"
+};
+static const char *size_names[COUNT_SIZES] = {
+	"le64", "le128", "le256", "le512", "le1024", "le1518", "jumbo"
+};
+
+void traffic_count(TrafficCounters *c, const unsigned char *frame,
+		int caplen, int len) {
+	c->packets++;
+	c->bytes += len;
+	int bucket = 0;
+	for (int limit=64; bucket < 5 && len > limit; limit *= 2)
+		bucket++;
+	if (bucket == 5 && len > 1518) bucket = 6;
+	c->sizes[bucket]++;
+
+	EtherFrame ef;
+	if (ether_classify(frame, caplen, &ef) != ETHER_IPV4 || ef.length < 20) {
+		c->protocols[COUNT_OTHER]++;
+		return;
+	}
+	const unsigned char *ip = ef.payload;
+	int hlen = (ip[0] & 0x0F) * 4;
+	switch (ip[9]) {
+		case 6:
+			c->protocols[COUNT_TCP]++;
+			if (hlen >= 20 && ef.length >= hlen + 14) {
+				unsigned char flags = ip[hlen+13];
+				for (int i=0; flags; i++, flags >>= 1)
+					if (flags & 1) c->flags[i]++;
+			}
+			break;
+		case 17:
+			c->protocols[COUNT_UDP]++;
+			break;
+		case 1:
+			c->protocols[COUNT_ICMP]++;
+			break;
+		default:
+			c->protocols[COUNT_OTHER]++;
+	}
+}
+
+/* the counters are plain words, summed and subtracted one by one */
+#define COUNTER_WORDS (sizeof(TrafficCounters) / sizeof(unsigned long long))
+
+static void add_delta(TrafficCounters *sum, const TrafficCounters &now,
+		const TrafficCounters &then) {
+	unsigned long long *s = (unsigned long long *)sum;
+	const unsigned long long *a = (const unsigned long long *)&now;
+	const unsigned long long *b = (const unsigned long long *)&then;
+	for (unsigned int i=0; i<COUNTER_WORDS; i++)
+		s[i] += a[i] - b[i];
+}
+
+static void add(TrafficCounters *sum, const TrafficCounters &c) {
+	unsigned long long *s = (unsigned long long *)sum;
+	const unsigned long long *a = (const unsigned long long *)&c;
+	for (unsigned int i=0; i<COUNTER_WORDS; i++)
+		s[i] += a[i];
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+WindowCollector::WindowCollector(int cores, Formatter *out) {
+	this->cores = cores;
+	this->out = out;
+	running = stopping = false;
+	if (posix_memalign((void **)&counters, 64, cores * sizeof(TrafficCounters))) {
+		perror("posix_memalign");
+		counters = NULL;
+		return;
+	}
+	memset(counters, 0, cores * sizeof(TrafficCounters));
+	memset(&last, 0, sizeof(last));
+	memset(&second, 0, sizeof(second));
+	memset(&minute, 0, sizeof(minute));
+	long long now = now_ns() / 1000000000LL;
+	second_start = now;
+	minute_start = now - now % 60;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	if (pthread_create(&thread, NULL, collect_thread, this)) {
+		perror("pthread_create");
+		return;
+	}
+	running = true;
+}
+
+WindowCollector::~WindowCollector(void) {
+	stop();
+	if (counters) {
+		pthread_mutex_destroy(&lock);
+		pthread_cond_destroy(&wake);
+	}
+	free(counters);
+}
+
+void WindowCollector::stop(void) {
+	if (!running) return;
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	running = false;
+}
+
+/* Fold everything counted since the last call into the open windows,
+ * first closing any window that ended before 'now' (seconds). */
+void WindowCollector::sample(long long now) {
+	TrafficCounters total;
+	memset(&total, 0, sizeof(total));
+	unsigned long long *t = (unsigned long long *)&total;
+	for (int i=0; i<cores; i++) {
+		/* written by one other thread; each word is read whole */
+		const unsigned long long *c = (const unsigned long long *)(counters + i);
+		for (unsigned int j=0; j<COUNTER_WORDS; j++)
+			t[j] += __atomic_load_n(c + j, __ATOMIC_RELAXED);
+	}
+	add_delta(&second, total, last);
+	last = total;
+
+	if (now > second_start) {
+		emit(1, second_start, second);
+		add(&minute, second);
+		memset(&second, 0, sizeof(second));
+		second_start = now;
+	}
+	if (now >= minute_start + 60) {
+		emit(60, minute_start, minute);
+		memset(&minute, 0, sizeof(minute));
+		minute_start = now - now % 60;
+	}
+}
+
+void WindowCollector::emit(int span, long long start,
+		const TrafficCounters &c) {
+	out->begin("Window");
+	out->field("span", span);
+	out->field_u64("start", start);
+	out->field_u64("packets", c.packets);
+	out->field_u64("bytes", c.bytes);
+	for (int i=0; i<NCOUNT_PROTOS; i++)
+		out->field_u64(protocol_names[i], c.protocols[i]);
+	for (int i=0; i<COUNT_FLAGS; i++)
+		out->field_u64(flag_names[i], c.flags[i]);
+	for (int i=0; i<COUNT_SIZES; i++)
+		out->field_u64(size_names[i], c.sizes[i]);
+	out->end();
+	out->end_record();
+	out->flush();
+}
+
+void *WindowCollector::collect_thread(void *arg) {
+	WindowCollector *wc = (WindowCollector *)arg;
+	pthread_mutex_lock(&wc->lock);
+	while (!wc->stopping) {
+		/* sleep until just past the next second boundary */
+		struct timespec until = { (time_t)(wc->second_start + 1), 1000000 };
+		if (pthread_cond_timedwait(&wc->wake, &wc->lock, &until) == 0
+				&& wc->stopping)
+			break;
+		wc->sample(now_ns() / 1000000000LL);
+	}
+	pthread_mutex_unlock(&wc->lock);
+
+	/* close the windows still open, however short */
+	wc->sample(wc->second_start);
+	wc->emit(1, wc->second_start, wc->second);
+	add(&wc->minute, wc->second);
+	wc->emit(60, wc->minute_start, wc->minute);
+	return NULL;
+}
@@ -0,0 +1,80 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <pthread.h>
+#include "format.h"
+
+/* Always-on traffic telemetry.  Each capturing thread counts into its own
+ * TrafficCounters, a cache-line-aligned block no other thread writes, with
+ * plain increments.  A collector thread wakes on every second boundary,
+ * reads each block, and subtracts what it read last time: the counters
+ * only ever grow, so it needs neither locks nor atomic updates from the
+ * capturing side.  The per-second differences are emitted as "Window"
+ * records, and summed into per-minute ones. */
+
+enum { COUNT_TCP, COUNT_UDP, COUNT_ICMP, COUNT_OTHER, NCOUNT_PROTOS };
+
+#define COUNT_FLAGS 8  /* TCP flag bits, FIN up to CWR */
+#define COUNT_SIZES 7  /* frame lengths: <=64, 128, 256, 512, 1024, 1518, more */
+
+struct TrafficCounters {
+	unsigned long long packets, bytes;
+	unsigned long long protocols[NCOUNT_PROTOS];
+	unsigned long long flags[COUNT_FLAGS];
+	unsigned long long sizes[COUNT_SIZES];
+} __attribute__((aligned(64)));
+
+/* count one Ethernet frame of len bytes, caplen of them captured */
+void traffic_count(TrafficCounters *c, const unsigned char *frame,
+	int caplen, int len);
+
+class WindowCollector {
+public:
+	/* records go to out, which only the collector thread touches */
+	WindowCollector(int cores, Formatter *out);
+	~WindowCollector(void);
+	bool ok(void) const { return running; }
+	TrafficCounters *core(int i) { return counters + i; }
+	/* emit the partial windows and stop the thread */
+	void stop(void);
+
+private:
+	static void *collect_thread(void *arg);
+	void sample(long long now);
+	void emit(int span, long long start, const TrafficCounters &c);
+
+	int cores;
+	TrafficCounters *counters;
+	TrafficCounters last, second, minute;
+	long long second_start, minute_start;
+	Formatter *out;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running, stopping;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "dedup.h"
+#include "ether.h"
+
+Deduper::Deduper(int window_ms, int nslots) {
+	unsigned int buckets = 1;
+	while (buckets * DEDUP_WAYS < (unsigned int)nslots) buckets *= 2;
+	slots = g_new0(Slot, buckets * DEDUP_WAYS);
+	mask = buckets - 1;
+	window = window_ms;
+	base = 0;
+	frames = duplicates = evictions = 0;
+}
+
+Deduper::~Deduper(void) {
+	g_free(slots);
+}
+
+Deduper *Deduper::parse(const char *spec) {
+	char *end;
+	long ms = strtol(spec, &end, 10), n = DEDUP_SLOTS;
+	if (end == spec || ms < 1) return NULL;
+	if (*end == ':') {
+		const char *p = end + 1;
+		n = strtol(p, &end, 10);
+		if (end == p || n < DEDUP_WAYS || n > (1 << 28)) return NULL;
+	}
+	if (*end) return NULL;
+	return new Deduper(ms, n);
+}
+
+static inline unsigned long long mix(unsigned long long h, unsigned long long w) {
+	h ^= w * 0x9E3779B97F4A7C15ULL;
+	return (h << 27 | h >> 37) * 0xC2B2AE3D27D4EB4FULL;
+}
+
+/* hash len bytes, a word at a time */
+static unsigned long long hash_bytes(unsigned long long h,
+		const unsigned char *p, int len) {
+	unsigned long long w;
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		h = mix(h, w);
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, p, len);
+		h = mix(h, w ^ ((unsigned long long)len << 56));
+	}
+	return h;
+}
+
+static unsigned long long frame_hash(const unsigned char *frame, int caplen) {
+	EtherFrame ef;
+	unsigned long long h = caplen;
+	if (ether_classify(frame, caplen, &ef) == ETHER_IPV4 && ef.length >= 20) {
+		/* everything but the TTL (byte 8) and the checksum (10, 11) */
+		const unsigned char *ip = ef.payload;
+		unsigned char head[20];
+		memcpy(head, ip, 20);
+		head[8] = head[10] = head[11] = 0;
+		h = hash_bytes(ef.length, head, 20);
+		h = hash_bytes(h, ip + 20, ef.length - 20);
+	}
+	else
+		h = hash_bytes(h, frame, caplen);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+bool Deduper::duplicate(const unsigned char *frame, int caplen, long long ts) {
+	if (base == 0) base = ts;
+	frames++;
+	unsigned long long h = frame_hash(frame, caplen);
+	unsigned int fp = (h >> 32) | 1;  /* 0 marks an empty slot */
+	unsigned int now = (ts - base) / 1000000;
+	Slot *bucket = slots + (h & mask) * DEDUP_WAYS;
+	Slot *victim = bucket;
+	bool live = true;  /* is the victim still inside the window? */
+	for (int i=0; i<DEDUP_WAYS; i++) {
+		Slot *s = bucket + i;
+		bool expired = s->fingerprint == 0 || now - s->ms > window;
+		if (!expired && s->fingerprint == fp) {
+			duplicates++;
+			return true;
+		}
+		/* take an expired slot if there is one, else the oldest */
+		if (live && (expired || s->ms < victim->ms)) {
+			victim = s;
+			live = !expired;
+		}
+	}
+	if (live) evictions++;
+	victim->fingerprint = fp;
+	victim->ms = now;
+	return false;
+}
+
+void Deduper::report(FILE *fp) const {
+	fprintf(fp, "dedup: %lu of %lu frames were duplicates (%.2f%%); %lu"
+		" evicted early\n", duplicates, frames,
+		frames ? 100.0 * duplicates / frames : 0.0, evictions);
+}
@@ -0,0 +1,65 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+/* Drops frames seen twice within a short window, as SPAN ports and tap
+ * aggregators produce.  Each frame is reduced to a 64-bit hash of its
+ * IPv4 datagram less the TTL and header checksum, which change between
+ * copies taken at different hops; frames that aren't IPv4 are hashed
+ * whole.  The hashes live in a fixed-size, set-associative table: the
+ * low bits pick a bucket of DEDUP_WAYS slots, each holding a 32-bit
+ * fingerprint and the time it was first seen; copies don't move that
+ * time on, so the window runs from the original.  A frame is a duplicate
+ * if its bucket holds its fingerprint from within the window; otherwise it
+ * takes the slot that is expired, or failing that the oldest.  Memory is
+ * fixed at 8 bytes a slot, however much traffic there is. */
+
+#define DEDUP_WAYS 8
+#define DEDUP_SLOTS 65536
+
+class Deduper {
+public:
+	/* window in milliseconds; slots is rounded up to a power of two */
+	Deduper(int window_ms, int slots = DEDUP_SLOTS);
+	~Deduper(void);
+	/* "MS" or "MS:SLOTS"; NULL if it makes no sense */
+	static Deduper *parse(const char *spec);
+	/* ts in nanoseconds; true if the frame repeats one from the window */
+	bool duplicate(const unsigned char *frame, int caplen, long long ts);
+	void report(FILE *fp) const;
+
+	unsigned long frames, duplicates;
+	unsigned long evictions;  /* live slots overwritten: the table is small */
+
+private:
+	struct Slot {
+		unsigned int fingerprint, ms;
+	};
+	Slot *slots;
+	unsigned int mask;  /* buckets - 1 */
+	unsigned int window;
+	long long base;  /* ns; slot times are milliseconds since then */
+};
+
+#endif
@@ -0,0 +1,159 @@
+#!/bin/bash
+# PacketKit - end-to-end throughput and loss benchmark.
+# Copyright (C) 2001 by Patrick Reynolds; distributed under the GNU
+# General Public License v2 or later (see the other source files).
+#
+# Builds a veth pair with one end in a private network namespace, drives
+# ./sender through each transmit backend at increasing rates, captures on
+# the far end with ./sniff, and reports what arrived.  Needs root.
+#
+# For each transmit backend and capture backend it prints one row per
+# rate: packets sent and received, loss, and CPU time per packet on each
+# side; then the highest rate reached before the first step that lost
+# anything.  -o writes the same rows as CSV.
+
+usage() {
+	cat >&2 <<USAGE
+Usage: $0 [options]
+  -r RATES   packet rates to try, in order (default "$RATES")
+  -d SECS    seconds per step (default $DURATION)
+  -x LIST    transmit backends: raw ring gso (default "$TX")
+  -c LIST    capture backends: packet (default "$CAPTURE")
+  -s BYTES   UDP payload size (default $SIZE)
+  -o FILE    also write the results as CSV
+USAGE
+	exit 1
+}
+
+RATES="10k 50k 100k 200k 400k 800k"
+DURATION=3
+TX="raw ring gso"
+CAPTURE="packet"
+SIZE=64
+CSV=
+while getopts "r:d:x:c:s:o:" opt; do
+	case $opt in
+		r) RATES=$OPTARG ;;
+		d) DURATION=$OPTARG ;;
+		x) TX=$OPTARG ;;
+		c) CAPTURE=$OPTARG ;;
+		s) SIZE=$OPTARG ;;
+		o) CSV=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+
+cd "$(dirname "$0")" || exit 1
+if [ "$(id -u)" != 0 ]; then
+	echo "$0: needs root, for the namespace and the raw sockets" >&2
+	exit 1
+fi
+for prog in sender sniff; do
+	if [ ! -x ./$prog ]; then
+		echo "$0: build ./$prog first" >&2
+		exit 1
+	fi
+done
+
+NS=pkbench$$
+HOST_IF=pkb$$a
+PEER_IF=pkb$$b
+HOST_ADDR=10.201.0.1
+PEER_ADDR=10.201.0.2
+PORT=9
+TMP=$(mktemp -d)
+
+cleanup() {
+	ip netns del $NS 2>/dev/null
+	ip link del $HOST_IF 2>/dev/null
+	rm -rf "$TMP"
+}
+trap cleanup EXIT INT TERM
+
+ip netns add $NS || exit 1
+ip link add $HOST_IF type veth peer name $PEER_IF || exit 1
+ip link set $PEER_IF netns $NS
+# veth would hand -g's 64-datagram sends across as one GSO packet; make
+# the stack split them, so the capture sees what a real NIC would send
+ip link set $HOST_IF gso_max_segs 1 2>/dev/null
+ip addr add $HOST_ADDR/24 dev $HOST_IF
+ip link set $HOST_IF up
+ip -n $NS addr add $PEER_ADDR/24 dev $PEER_IF
+ip -n $NS link set $PEER_IF up
+ip -n $NS link set lo up
+PEER_MAC=$(ip -n $NS -o link show $PEER_IF | sed -n 's/.*link\/ether \([0-9a-f:]*\).*/\1/p')
+# settle the neighbour entry, so the first packets aren't held for ARP
+ip neigh replace $PEER_ADDR lladdr $PEER_MAC dev $HOST_IF
+
+DATA=$(head -c "$SIZE" /dev/zero | od -An -v -tx1 | tr -d ' \n')
+cat > "$TMP/spec" <<SPEC
+IP( protocol=udp source=$HOST_ADDR destination=$PEER_ADDR
+	payload=UDP( sport=1234 dport=$PORT data=($DATA) ) )
+SPEC
+
+tx_args() {
+	case $1 in
+		raw) echo "" ;;
+		ring) echo "-i $HOST_IF -m $PEER_MAC" ;;
+		gso) echo "-g" ;;
+		*) echo "$0: unknown transmit backend $1" >&2; exit 1 ;;
+	esac
+}
+
+capture_args() {
+	case $1 in
+		packet) echo "" ;;
+		*) echo "$0: unknown capture backend $1" >&2; exit 1 ;;
+	esac
+}
+
+# the value of KEY on the "stats:" line sender and sniff print last
+stat() {
+	sed -n 's/^stats: //p' "$1" | tr ' ' '\n' | sed -n "s/^$2=//p"
+}
+
+[ -n "$CSV" ] && echo "tx,capture,rate,sent,received,loss_pct,tx_ns_per_pkt,rx_ns_per_pkt" > "$CSV"
+for tx in $TX; do
+	targs=$(tx_args $tx) || exit 1
+	for cap in $CAPTURE; do
+		cargs=$(capture_args $cap) || exit 1
+		printf "\ntransmit %s, capture %s, %d-byte payloads\n" $tx $cap $SIZE
+		printf "%10s %12s %12s %8s %12s %12s\n" rate sent received loss tx_ns/pkt rx_ns/pkt
+		best=none
+		lossy=
+		for rate in $RATES; do
+			ip netns exec $NS ./sniff -i $PEER_IF $cargs -c -t 1 \
+				-f "udp and dst port $PORT" 2> "$TMP/sniff" &
+			sniff_pid=$!
+			sleep 0.5
+			./sender -q -r $rate -d $DURATION $targs "$TMP/spec" 2> "$TMP/sender" > /dev/null
+			wait $sniff_pid
+
+			sent=$(stat "$TMP/sender" packets)
+			tx_cpu=$(stat "$TMP/sender" cpu)
+			received=$(stat "$TMP/sniff" packets)
+			rx_cpu=$(stat "$TMP/sniff" cpu)
+			if [ -z "$sent" ] || [ -z "$received" ]; then
+				echo "$0: $tx at $rate failed:" >&2
+				cat "$TMP/sender" "$TMP/sniff" >&2
+				lossy=1
+				continue
+			fi
+			read loss tx_ns rx_ns <<< "$(awk -v s=$sent -v r=$received \
+				-v tc=$tx_cpu -v rc=$rx_cpu 'BEGIN {
+					loss = s > 0 ? 100 * (s - r) / s : 0; if (loss < 0) loss = 0
+					printf "%.3f %.0f %.0f", loss, s ? tc * 1e9 / s : 0,
+						r ? rc * 1e9 / r : 0 }')"
+			printf "%10s %12s %12s %7s%% %12s %12s\n" $rate $sent $received $loss $tx_ns $rx_ns
+			[ -n "$CSV" ] && echo "$tx,$cap,$rate,$sent,$received,$loss,$tx_ns,$rx_ns" >> "$CSV"
+			# rates are tried in order: past the first loss, a clean step
+			# is luck, not headroom
+			if [ "$received" -lt "$sent" ]; then
+				lossy=1
+			elif [ -z "$lossy" ]; then
+				best=$rate
+			fi
+		done
+		echo "highest lossless rate: $best"
+	done
+done
@@ -0,0 +1,101 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "ether.h"
+
+static const char *class_names[NETHER_CLASSES] = {
+	"other", "ipv4", "arp", "ipv6", "tagged", "bad"
+};
+
+/* ethertype -> class, for every ethertype */
+static struct EtherTable {
+	EtherTable(void) {
+		memset(cls, ETHER_OTHER, sizeof(cls));
+		cls[0x0800] = ETHER_IPV4;
+		cls[0x0806] = ETHER_ARP;
+		cls[0x86DD] = ETHER_IPV6;
+		cls[0x8100] = ETHER_TAG;  /* 802.1Q */
+		cls[0x88A8] = ETHER_TAG;  /* 802.1ad service tag */
+		cls[0x9100] = ETHER_TAG;  /* pre-standard QinQ */
+	}
+	unsigned char cls[65536];
+} table;
+
+int ether_classify(const unsigned char *frame, int caplen, EtherFrame *ef) {
+	int off = 12, type, cls;
+	ef->tags = 0;
+	for (;;) {
+		if (caplen < off + 2) {
+			ef->cls = ETHER_BAD;
+			return ETHER_BAD;
+		}
+		type = (frame[off] << 8) | frame[off+1];
+		cls = table.cls[type];
+		off += 2;
+		if (cls != ETHER_TAG) break;
+		if (ef->tags == ETHER_MAX_TAGS || caplen < off + 2) {
+			ef->cls = ETHER_BAD;
+			return ETHER_BAD;
+		}
+		ef->vlan[ef->tags++] = ((frame[off] & 0x0F) << 8) | frame[off+1];
+		off += 2;
+	}
+	ef->cls = cls;
+	ef->ethertype = type;
+	ef->payload = frame + off;
+	ef->length = caplen - off;
+	return cls;
+}
+
+const char *ether_class_name(int cls) {
+	return cls >= 0 && cls < NETHER_CLASSES ? class_names[cls] : "?";
+}
+
+EtherClassifier::EtherClassifier(void) {
+	memset(packets, 0, sizeof(packets));
+	memset(vlan_packets, 0, sizeof(vlan_packets));
+}
+
+int EtherClassifier::classify(const unsigned char *frame, int caplen,
+		EtherFrame *ef) {
+	int cls = ether_classify(frame, caplen, ef);
+	packets[cls]++;
+	if (cls != ETHER_BAD && ef->tags) vlan_packets[ef->vlan[0]]++;
+	return cls;
+}
+
+void EtherClassifier::print(FILE *fp) const {
+	const char *sep = "";
+	for (int i=0; i<NETHER_CLASSES; i++)
+		if (packets[i]) {
+			fprintf(fp, "%s%s %lu", sep, class_names[i], packets[i]);
+			sep = ", ";
+		}
+	for (int i=0; i<ETHER_VLANS; i++)
+		if (vlan_packets[i]) {
+			fprintf(fp, "%svlan %d %lu", sep, i, vlan_packets[i]);
+			sep = ", ";
+		}
+	if (*sep) fputc('\n', fp);
+}
@@ -0,0 +1,67 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef ETHER_H
+#define ETHER_H
+
+#include <stdio.h>
+
+/* Ethernet frame classification.  The ethertype is looked up in a table
+ * covering all 65536 values, so finding a frame's class is one load; up
+ * to ETHER_MAX_TAGS 802.1Q or 802.1ad tags are stepped over on the way,
+ * and their VLAN IDs recorded.  Nothing is copied: the result points
+ * into the frame. */
+
+#define ETHER_HEADER 14
+#define ETHER_MAX_TAGS 2
+#define ETHER_VLANS 4096
+
+enum { ETHER_OTHER, ETHER_IPV4, ETHER_ARP, ETHER_IPV6, ETHER_TAG,
+	ETHER_BAD, NETHER_CLASSES };
+
+struct EtherFrame {
+	int cls;        /* ETHER_OTHER ... ETHER_BAD */
+	int ethertype;  /* after any tags */
+	int tags;       /* how many tags were stepped over */
+	int vlan[ETHER_MAX_TAGS];  /* outermost first */
+	const unsigned char *payload;  /* the network-layer header */
+	int length;     /* captured bytes from payload on */
+};
+
+/* Classify a frame of caplen bytes.  Frames too short for their headers,
+ * or with more than ETHER_MAX_TAGS tags, are ETHER_BAD. */
+int ether_classify(const unsigned char *frame, int caplen, EtherFrame *ef);
+const char *ether_class_name(int cls);
+
+/* Classifies frames and counts them per class and per outermost VLAN. */
+class EtherClassifier {
+public:
+	EtherClassifier(void);
+	/* returns the frame's class */
+	int classify(const unsigned char *frame, int caplen, EtherFrame *ef);
+	void print(FILE *fp) const;
+
+	unsigned long packets[NETHER_CLASSES];
+	unsigned long vlan_packets[ETHER_VLANS];
+};
+
+#endif
@@ -0,0 +1,343 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include "filter.h"
+#include "flags.h"
+#include "icmppacket.h"
+#include "ippacket.h"
+#include "resolve.h"
+#include "tcppacket.h"
+#include "udppacket.h"
+
+#define MAX_STACK 64
+
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_ALL, OP_AND, OP_OR,
+	OP_NOT };
+
+static const char *field_names[NFIELDS] = {
+	"proto", "src", "dst", "sport", "dport", "len", "ttl", "flags", "icmptype",
+	"icmpcode"
+};
+
+int field_number(const char *name) {
+	for (int i=0; i<NFIELDS; i++)
+		if (!strcasecmp(name, field_names[i])) return i;
+	if (!strcasecmp(name, "protocol")) return FIELD_PROTOCOL;
+	if (!strcasecmp(name, "length")) return FIELD_LENGTH;
+	return -1;
+}
+
+const char *field_name(int field) {
+	return field >= 0 && field < NFIELDS ? field_names[field] : NULL;
+}
+
+void packet_fields(const IPPacket &ip, unsigned int *v) {
+	v[FIELD_PROTOCOL] = ip.protocol;
+	v[FIELD_SRC] = ntohl(ip.src.s_addr);
+	v[FIELD_DST] = ntohl(ip.dst.s_addr);
+	v[FIELD_SPORT] = v[FIELD_DPORT] = v[FIELD_FLAGS] = 0;
+	v[FIELD_ICMP_TYPE] = v[FIELD_ICMP_CODE] = 0;
+	v[FIELD_LENGTH] = ip.len;
+	v[FIELD_TTL] = ip.ttl;
+	if (ip.payload && ip.protocol == IP_TCP) {
+		TCPPacket *tcp = (TCPPacket*)ip.payload;
+		v[FIELD_SPORT] = tcp->sport;
+		v[FIELD_DPORT] = tcp->dport;
+		v[FIELD_FLAGS] = tcp->flags;
+	}
+	else if (ip.payload && ip.protocol == IP_UDP) {
+		UDPPacket *udp = (UDPPacket*)ip.payload;
+		v[FIELD_SPORT] = udp->sport;
+		v[FIELD_DPORT] = udp->dport;
+	}
+	else if (ip.payload && ip.protocol == IP_ICMP) {
+		ICMPPacket *icmp = (ICMPPacket*)ip.payload;
+		v[FIELD_ICMP_TYPE] = icmp->type;
+		v[FIELD_ICMP_CODE] = icmp->code;
+	}
+}
+
+bool datagram_fields(const unsigned char *ip, int len, unsigned int *v) {
+	int hlen = (ip[0] & 0x0F) * 4;
+	if (len < 20 || hlen < 20) return false;
+	v[FIELD_PROTOCOL] = ip[9];
+	v[FIELD_SRC] = ip[12] << 24 | ip[13] << 16 | ip[14] << 8 | ip[15];
+	v[FIELD_DST] = ip[16] << 24 | ip[17] << 16 | ip[18] << 8 | ip[19];
+	v[FIELD_SPORT] = v[FIELD_DPORT] = v[FIELD_FLAGS] = 0;
+	v[FIELD_ICMP_TYPE] = v[FIELD_ICMP_CODE] = 0;
+	v[FIELD_LENGTH] = ip[2] << 8 | ip[3];
+	v[FIELD_TTL] = ip[8];
+
+	/* the same lengths the decoders insist on */
+	int avail = MIN((int)v[FIELD_LENGTH], len) - hlen;
+	const unsigned char *p = ip + hlen;
+	switch (ip[9]) {
+		case IP_TCP:
+			if (avail < 20) break;
+			v[FIELD_FLAGS] = p[13] & 0x3F;
+			/* fall through */
+		case IP_UDP:
+			if (avail < 8) break;
+			v[FIELD_SPORT] = p[0] << 8 | p[1];
+			v[FIELD_DPORT] = p[2] << 8 | p[3];
+			break;
+		case IP_ICMP:
+			if (avail < 8) break;
+			v[FIELD_ICMP_TYPE] = p[0];
+			v[FIELD_ICMP_CODE] = p[1];
+			break;
+	}
+	return true;
+}
+
+Filter::Filter(void) {
+	ops = NULL;
+	nops = 0;
+}
+
+Filter::~Filter(void) {
+	g_free(ops);
+}
+
+void Filter::emit(int code, int field, unsigned int value, unsigned int mask) {
+	ops = g_renew(Op, ops, nops+1);
+	Op *op = &ops[nops++];
+	op->code = code;
+	op->field = field;
+	op->value = value & mask;
+	op->mask = mask;
+}
+
+/* Words run until white space, a parenthesis or a comparison; those
+ * are tokens of their own.  An empty token is the end of the input. */
+bool Filter::next_token(void) {
+	int n = 0;
+	while (isspace((unsigned char)*pos)) pos++;
+	if (*pos == '(' || *pos == ')')
+		token[n++] = *pos++;
+	else if (strchr("<>=!", *pos) && *pos)
+		while (*pos && strchr("<>=!", *pos) && n < (int)sizeof(token)-1)
+			token[n++] = *pos++;
+	else
+		while (*pos && !isspace((unsigned char)*pos) && !strchr("()<>=!", *pos)
+				&& n < (int)sizeof(token)-1)
+			token[n++] = *pos++;
+	token[n] = '\0';
+	return n > 0;
+}
+
+bool Filter::expect_number(unsigned int *v) {
+	char *end;
+	if (!token[0]) return false;
+	*v = strtoul(token, &end, 0);
+	if (*end) return false;
+	next_token();
+	return true;
+}
+
+bool Filter::compile(const char *expr) {
+	g_free(ops);
+	ops = NULL;
+	nops = 0;
+	pos = expr;
+	next_token();
+	if (!token[0]) return true;  /* matches everything */
+	if (!parse_or() || token[0]) {
+		g_warning("filter: syntax error near \"%s\"", token[0] ? token : "end");
+		nops = 0;
+		return false;
+	}
+
+	/* every test pushes and every and/or pops, so the depth is bounded */
+	int depth = 0, max = 0;
+	for (int i=0; i<nops; i++) {
+		if (ops[i].code == OP_AND || ops[i].code == OP_OR) depth--;
+		else if (ops[i].code != OP_NOT) depth++;
+		if (depth > max) max = depth;
+	}
+	if (max > MAX_STACK) {
+		g_warning("filter: expression too deep");
+		nops = 0;
+		return false;
+	}
+	return true;
+}
+
+bool Filter::parse_or(void) {
+	if (!parse_and()) return false;
+	while (!strcasecmp(token, "or") || !strcmp(token, "||")) {
+		next_token();
+		if (!parse_and()) return false;
+		emit(OP_OR);
+	}
+	return true;
+}
+
+bool Filter::parse_and(void) {
+	if (!parse_unary()) return false;
+	while (token[0] && strcmp(token, ")") && strcasecmp(token, "or")
+			&& strcmp(token, "||")) {
+		if (!strcasecmp(token, "and") || !strcmp(token, "&&")) next_token();
+		if (!parse_unary()) return false;
+		emit(OP_AND);
+	}
+	return true;
+}
+
+bool Filter::parse_unary(void) {
+	if (!strcasecmp(token, "not") || !strcmp(token, "!")) {
+		next_token();
+		if (!parse_unary()) return false;
+		emit(OP_NOT);
+		return true;
+	}
+	if (!strcmp(token, "(")) {
+		next_token();
+		if (!parse_or() || strcmp(token, ")")) return false;
+		next_token();
+		return true;
+	}
+	return parse_test();
+}
+
+bool Filter::parse_test(void) {
+	static const struct { const char *name; int protocol; } protocols[] = {
+		{ "tcp", IP_TCP }, { "udp", IP_UDP }, { "icmp", IP_ICMP }, { NULL, 0 }
+	};
+	static const char *compare_ops[] = { "=", "!=", "<", "<=", ">", ">=", NULL };
+	unsigned int v;
+
+	for (int i=0; protocols[i].name; i++)
+		if (!strcasecmp(token, protocols[i].name)) {
+			next_token();
+			emit(OP_EQ, FIELD_PROTOCOL, protocols[i].protocol);
+			return true;
+		}
+	if (!strcasecmp(token, "proto")) {
+		next_token();
+		int n = protocol_number(token);
+		if (n < 0 && !expect_number(&v)) return false;
+		if (n >= 0) {
+			v = n;
+			next_token();
+		}
+		emit(OP_EQ, FIELD_PROTOCOL, v);
+		return true;
+	}
+	if (!strcasecmp(token, "len") || !strcasecmp(token, "length")
+			|| !strcasecmp(token, "ttl") || !strcasecmp(token, "icmptype")
+			|| !strcasecmp(token, "icmpcode")) {
+		int field = field_number(token);
+		int code = -1;
+		next_token();
+		for (int i=0; compare_ops[i]; i++)
+			if (!strcmp(token, compare_ops[i])) code = OP_EQ + i;
+		if (code < 0) return false;
+		next_token();
+		if (!expect_number(&v)) return false;
+		emit(code, field, v);
+		if (field == FIELD_ICMP_TYPE || field == FIELD_ICMP_CODE) {
+			/* zero means echo reply, not "not ICMP" */
+			emit(OP_EQ, FIELD_PROTOCOL, IP_ICMP);
+			emit(OP_AND);
+		}
+		return true;
+	}
+	if (!strcasecmp(token, "flags")) {
+		next_token();
+		if (!token[0]) return false;
+		emit(OP_ALL, FIELD_FLAGS, parse_flags(token, tcp_flag_map));
+		next_token();
+		return true;
+	}
+
+	/* the rest may have a direction: src, dst, or either */
+	bool src = true, dst = true;
+	if (!strcasecmp(token, "src")) dst = false;
+	else if (!strcasecmp(token, "dst")) src = false;
+	if (!src || !dst) next_token();
+
+	if (!strcasecmp(token, "port") || !strcasecmp(token, "sport")
+			|| !strcasecmp(token, "dport")) {
+		if (!strcasecmp(token, "sport")) dst = false;
+		if (!strcasecmp(token, "dport")) src = false;
+		next_token();
+		if (!expect_number(&v)) return false;
+		if (src) emit(OP_EQ, FIELD_SPORT, v);
+		if (dst) emit(OP_EQ, FIELD_DPORT, v);
+		if (src && dst) emit(OP_OR);
+		return true;
+	}
+
+	bool net = !strcasecmp(token, "net");
+	if (net || !strcasecmp(token, "host")) next_token();
+	else if (src && dst) return false;  /* not a word we know */
+	char addr[32];
+	int bits = 32;
+	struct in_addr a;
+	if (sscanf(token, "%31[0-9.]/%d", addr, &bits) < 1 || !inet_aton(addr, &a)
+			|| bits < 0 || bits > 32 || (!net && bits != 32))
+		return false;
+	next_token();
+	unsigned int mask = bits ? ~0U << (32 - bits) : 0;
+	if (src) emit(OP_EQ, FIELD_SRC, ntohl(a.s_addr), mask);
+	if (dst) emit(OP_EQ, FIELD_DST, ntohl(a.s_addr), mask);
+	if (src && dst) emit(OP_OR);
+	return true;
+}
+
+bool Filter::match(const unsigned int *fields) const {
+	bool stack[MAX_STACK];
+	int sp = 0;
+	if (nops == 0) return true;
+	for (int i=0; i<nops; i++) {
+		const Op *op = &ops[i];
+		unsigned int v = fields[op->field] & op->mask;
+		switch (op->code) {
+			case OP_EQ: stack[sp++] = v == op->value; break;
+			case OP_NE: stack[sp++] = v != op->value; break;
+			case OP_LT: stack[sp++] = v < op->value; break;
+			case OP_LE: stack[sp++] = v <= op->value; break;
+			case OP_GT: stack[sp++] = v > op->value; break;
+			case OP_GE: stack[sp++] = v >= op->value; break;
+			case OP_ALL: stack[sp++] = (v & op->value) == op->value; break;
+			case OP_AND: sp--; stack[sp-1] = stack[sp-1] && stack[sp]; break;
+			case OP_OR: sp--; stack[sp-1] = stack[sp-1] || stack[sp]; break;
+			case OP_NOT: stack[sp-1] = !stack[sp-1]; break;
+		}
+	}
+	return stack[0];
+}
+
+bool Filter::match(const IPPacket &ip) const {
+	unsigned int fields[NFIELDS];
+	if (nops == 0) return true;
+	packet_fields(ip, fields);
+	return match(fields);
+}
@@ -0,0 +1,83 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+class IPPacket;
+
+/* Packet fields a filter can test and a query can group by.  Addresses
+ * are in host byte order; ports are zero unless the packet is TCP or
+ * UDP, flags are zero unless it is TCP, and the ICMP type and code are
+ * zero unless it is ICMP. */
+enum { FIELD_PROTOCOL, FIELD_SRC, FIELD_DST, FIELD_SPORT, FIELD_DPORT,
+	FIELD_LENGTH, FIELD_TTL, FIELD_FLAGS, FIELD_ICMP_TYPE, FIELD_ICMP_CODE,
+	NFIELDS };
+
+int field_number(const char *name);  /* -1 if unknown */
+const char *field_name(int field);
+void packet_fields(const IPPacket &ip, unsigned int *v);  /* v[NFIELDS] */
+/* the same, read straight from an IPv4 datagram of len captured bytes
+ * without decoding it, for the hot path; false if it is too short */
+bool datagram_fields(const unsigned char *ip, int len, unsigned int *v);
+
+/* A compiled packet filter.  The language, loosely after tcpdump's:
+ *   tcp, udp, icmp, proto N
+ *   host A, src A, dst A          (src host A and dst host A also work)
+ *   net A/N, src net A/N, dst net A/N
+ *   port N, sport N, dport N      (src port N and dst port N also work)
+ *   len OP N, ttl OP N            where OP is one of < <= = != >= >
+ *   icmptype OP N, icmpcode OP N  ICMP packets only
+ *   flags SYN|ACK                 all of these TCP flags set
+ *   not X, X and Y, X or Y, ( X ) with the usual precedence; two terms
+ *   side by side are and-ed.
+ * It compiles to a postfix program over packet_fields(). */
+class Filter {
+public:
+	Filter(void);
+	~Filter(void);
+	bool compile(const char *expr);  /* warns and returns false on error */
+	bool empty(void) const { return nops == 0; }
+	bool match(const IPPacket &ip) const;
+	bool match(const unsigned int *fields) const;
+
+private:
+	struct Op {
+		int code, field;
+		unsigned int value, mask;
+	};
+	void emit(int code, int field = 0, unsigned int value = 0,
+		unsigned int mask = ~0U);
+	bool parse_or(void);
+	bool parse_and(void);
+	bool parse_unary(void);
+	bool parse_test(void);
+	bool next_token(void);
+	bool expect_number(unsigned int *v);
+
+	Op *ops;
+	int nops;
+	const char *pos;
+	char token[64];
+};
+
+#endif
@@ -0,0 +1,380 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <glib.h>
+#include "format.h"
+#include "resolve.h"
+
+/* write out the buffer once a finished record leaves it this full */
+#define FLUSH_SIZE 65536
+
+static const char digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+static const char hex_digits[] = "0123456789abcdef";
+
+int parse_format(const char *name) {
+	if (!strcasecmp(name, "text")) return FORMAT_TEXT;
+	if (!strcasecmp(name, "json")) return FORMAT_JSON;
+	if (!strcasecmp(name, "csv")) return FORMAT_CSV;
+	return -1;
+}
+
+Formatter::Formatter(int mode) {
+	init(mode);
+}
+
+Formatter::Formatter(FILE *fp, int mode) {
+	init(mode);
+	this->fp = fp;
+}
+
+Formatter::Formatter(int fd, int mode) {
+	init(mode);
+	this->fd = fd;
+}
+
+void Formatter::init(int mode) {
+	this->mode = mode;
+	fp = NULL;
+	fd = -1;
+	alloc = 4096;  /* grows to FLUSH_SIZE and a record when streaming */
+	buf = g_new(char, alloc);
+	used = 0;
+	depth = 0;
+	first[0] = true;
+	layer = "";
+	tag_name = tag_value = NULL;
+	row_start = 0;
+	columns[0] = last_columns[0] = '\0';
+	ncolumns = 0;
+}
+
+Formatter::~Formatter(void) {
+	flush();
+	g_free(buf);
+}
+
+void Formatter::reserve(int n) {
+	if (used + n > alloc) {
+		while (used + n > alloc) alloc *= 2;
+		buf = (char*)g_realloc(buf, alloc);
+	}
+}
+
+void Formatter::put(const char *s, int n) {
+	reserve(n);
+	memcpy(buf+used, s, n);
+	used += n;
+}
+
+void Formatter::put(const char *s) {
+	put(s, strlen(s));
+}
+
+void Formatter::put_uint(unsigned int v) {
+	char tmp[10];
+	int i = sizeof(tmp);
+	while (v >= 100) {
+		unsigned int q = v / 100;
+		i -= 2;
+		memcpy(tmp+i, digit_pairs + 2*(v - q*100), 2);
+		v = q;
+	}
+	if (v >= 10) {
+		i -= 2;
+		memcpy(tmp+i, digit_pairs + 2*v, 2);
+	}
+	else
+		tmp[--i] = '0' + v;
+	put(tmp+i, sizeof(tmp)-i);
+}
+
+void Formatter::put_u64(unsigned long long v) {
+	if (v <= 0xFFFFFFFFULL) {
+		put_uint(v);
+		return;
+	}
+	char tmp[20];
+	int i = sizeof(tmp);
+	while (v >= 100) {
+		unsigned long long q = v / 100;
+		i -= 2;
+		memcpy(tmp+i, digit_pairs + 2*(v - q*100), 2);
+		v = q;
+	}
+	if (v >= 10) {
+		i -= 2;
+		memcpy(tmp+i, digit_pairs + 2*v, 2);
+	}
+	else
+		tmp[--i] = '0' + v;
+	put(tmp+i, sizeof(tmp)-i);
+}
+
+void Formatter::put_hex(unsigned int v) {
+	char tmp[10];
+	int i = sizeof(tmp);
+	do {
+		tmp[--i] = hex_digits[v & 0xF];
+		v >>= 4;
+	} while (v);
+	tmp[--i] = 'x';
+	tmp[--i] = '0';
+	put(tmp+i, sizeof(tmp)-i);
+}
+
+/* a JSON string or a CSV field, quoted and escaped as that mode needs */
+void Formatter::put_escaped(const char *s) {
+	if (mode == FORMAT_JSON) {
+		put('"');
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\') put('\\');
+			if ((unsigned char)*s < 0x20) {
+				put("\\u00", 4);
+				put(hex_digits[(*s >> 4) & 0xF]);
+				put(hex_digits[*s & 0xF]);
+			}
+			else
+				put(*s);
+		}
+		put('"');
+	}
+	else if (mode == FORMAT_CSV && strpbrk(s, ",\"\n")) {
+		put('"');
+		for (; *s; s++) {
+			if (*s == '"') put('"');
+			put(*s);
+		}
+		put('"');
+	}
+	else
+		put(s);
+}
+
+bool Formatter::key(const char *name, bool show) {
+	switch (mode) {
+		case FORMAT_TEXT:
+			if (!show) return false;
+			if (!first[depth]) put(' ');
+			put(name);
+			put('=');
+			break;
+		case FORMAT_JSON:
+			if (!first[depth]) put(',');
+			put('"');
+			put(name);
+			put("\":", 2);
+			break;
+		case FORMAT_CSV: {
+			if (used > row_start) put(',');
+			/* column name: lowercased layer, a dot, the field name */
+			int n = strlen(columns);
+			char *p = columns + n, *end = columns + sizeof(columns) - 1;
+			if (ncolumns && p < end) *p++ = ',';
+			for (const char *s=layer; *s && p < end; s++)
+				*p++ = g_ascii_tolower(*s);
+			if (p < end) *p++ = '.';
+			for (const char *s=name; *s && p < end; s++)
+				*p++ = *s;
+			*p = '\0';
+			ncolumns++;
+			break;
+		}
+	}
+	first[depth] = false;
+	return true;
+}
+
+void Formatter::begin(const char *layer) {
+	if (depth == 0) {
+		row_start = used;
+		columns[0] = '\0';
+		ncolumns = 0;
+	}
+	if (mode == FORMAT_TEXT) {
+		put(layer);
+		put('(');
+	}
+	else if (mode == FORMAT_JSON) {
+		put("{\"layer\":\"", 10);
+		put(layer);
+		put('"');
+	}
+	if (depth < (int)G_N_ELEMENTS(first) - 1) depth++;
+	first[depth] = mode != FORMAT_JSON;
+	this->layer = layer;
+	if (depth == 1 && tag_value) field_str(tag_name, tag_value);
+}
+
+void Formatter::tag(const char *name, const char *value) {
+	tag_name = name;
+	tag_value = value;
+}
+
+void Formatter::end(void) {
+	if (mode == FORMAT_TEXT)
+		put(')');
+	else if (mode == FORMAT_JSON)
+		put('}');
+	if (depth > 0) depth--;
+}
+
+void Formatter::begin_payload(const char *name) {
+	if (mode != FORMAT_CSV) key(name, true);
+}
+
+void Formatter::field(const char *name, unsigned int v, bool show) {
+	if (key(name, show)) put_uint(v);
+}
+
+void Formatter::field_u64(const char *name, unsigned long long v,
+		bool show) {
+	if (key(name, show)) put_u64(v);
+}
+
+void Formatter::field_hex(const char *name, unsigned int v, bool show) {
+	if (!key(name, show)) return;
+	if (mode == FORMAT_TEXT)
+		put_hex(v);
+	else
+		put_uint(v);
+}
+
+void Formatter::field_symbol(const char *name, unsigned int v,
+		const char *symbol, bool show) {
+	if (!key(name, show)) return;
+	if (mode == FORMAT_TEXT && symbol)
+		put(symbol);
+	else
+		put_uint(v);
+}
+
+void Formatter::field_str(const char *name, const char *s, bool show) {
+	if (!key(name, show)) return;
+	if (s)
+		put_escaped(s);
+	else if (mode == FORMAT_JSON)
+		put("null", 4);
+}
+
+void Formatter::field_flags(const char *name, int flags, const Flag *map,
+		bool show) {
+	if (!key(name, show)) return;
+	if (mode == FORMAT_JSON) put('"');
+	bool need_sep = false;
+	for (int i=0; map[i].n; i++)
+		if (flags & map[i].n) {
+			if (need_sep) put('|');
+			put(map[i].name);
+			need_sep = true;
+		}
+	if (mode == FORMAT_JSON) put('"');
+}
+
+void Formatter::field_addr(const char *name, struct in_addr a, bool show) {
+	if (!key(name, show)) return;
+	char host[HOST_NAME_MAX_LEN];
+	if (host_name(a, host, sizeof(host))) {
+		put_escaped(host);
+		return;
+	}
+	const unsigned char *p = (const unsigned char*)&a;
+	if (mode == FORMAT_JSON) put('"');
+	for (int i=0; i<4; i++) {
+		if (i) put('.');
+		put_uint(p[i]);
+	}
+	if (mode == FORMAT_JSON) put('"');
+}
+
+void Formatter::field_data(const char *name, const unsigned char *d, int len,
+		bool show) {
+	if (!key(name, show)) return;
+	if (mode != FORMAT_CSV) put(mode == FORMAT_TEXT ? '(' : '"');
+	reserve(2*len);
+	char *p = buf + used;
+	for (int i=0; i<len; i++) {
+		*p++ = hex_digits[d[i] >> 4];
+		*p++ = hex_digits[d[i] & 0xF];
+	}
+	used += 2*len;
+	if (mode != FORMAT_CSV) put(mode == FORMAT_TEXT ? ')' : '"');
+}
+
+void Formatter::end_record(void) {
+	if (mode == FORMAT_CSV && strcmp(columns, last_columns)) {
+		/* the columns changed: slip a header line in ahead of the row */
+		int n = strlen(columns) + 2;
+		reserve(n);
+		memmove(buf + row_start + n, buf + row_start, used - row_start);
+		buf[row_start] = '#';
+		memcpy(buf + row_start + 1, columns, n - 2);
+		buf[row_start + n - 1] = '\n';
+		used += n;
+		strcpy(last_columns, columns);
+	}
+	put('\n');
+	depth = 0;
+	first[0] = true;
+	tag_value = NULL;
+	row_start = used;
+	if (used >= FLUSH_SIZE) flush();
+}
+
+/* raw bytes, the way Buffer::print() shows them */
+void Formatter::dump(const unsigned char *d, int len) {
+	put("buffer = { ", 11);
+	for (int i=0; i<len; i++) {
+		if (i > 0) put(' ');
+		put_hex(d[i]);
+	}
+	put(" }\n", 3);
+}
+
+void Formatter::flush(void) {
+	if (used == 0) return;
+	if (fp) {
+		fwrite(buf, 1, used, fp);
+		fflush(fp);
+	}
+	else if (fd >= 0) {
+		int off = 0;
+		while (off < used) {
+			ssize_t n = write(fd, buf+off, used-off);
+			if (n <= 0) {
+				perror("write");
+				break;
+			}
+			off += n;
+		}
+	}
+	else
+		return;  /* no sink: the caller takes the data */
+	used = row_start = 0;
+}
@@ -0,0 +1,111 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdio.h>
+#include <arpa/inet.h>
+#include "flags.h"
+
+enum { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV };
+
+int parse_format(const char *name);  /* -1 if unknown */
+
+/* Renders decoded packets into a reusable buffer, which goes out in
+ * large writes.  Packets describe themselves with format(), calling the
+ * field methods below; the mode decides what that looks like:
+ *   text  IP(length=40 ... payload=TCP(sport=1 ...)), as parse() reads
+ *   json  one object per record, payloads nested under "payload"
+ *   csv   one row per record, columns named layer.field; a "#" header
+ *         line goes out whenever the columns change
+ * Fields with show=false are left out of text output only, which keeps it
+ * terse; json and csv always carry every field.  With no sink, output
+ * collects until the caller takes it with data() and reset(). */
+class Formatter {
+public:
+	Formatter(int mode);
+	Formatter(FILE *fp, int mode);
+	Formatter(int fd, int mode);
+	~Formatter(void);
+
+	void begin(const char *layer);
+	void end(void);
+	void begin_payload(const char *name);
+	void field(const char *name, unsigned int v, bool show = true);
+	void field_u64(const char *name, unsigned long long v, bool show = true);
+	void field_hex(const char *name, unsigned int v, bool show = true);
+	void field_symbol(const char *name, unsigned int v, const char *symbol,
+		bool show = true);
+	void field_str(const char *name, const char *s, bool show = true);
+	void field_flags(const char *name, int flags, const Flag *map,
+		bool show = true);
+	void field_addr(const char *name, struct in_addr a, bool show = true);
+	void field_data(const char *name, const unsigned char *d, int len,
+		bool show = true);
+	void end_record(void);
+	/* add name=value to the next record's outermost layer, first */
+	void tag(const char *name, const char *value);
+	void dump(const unsigned char *d, int len);
+	void flush(void);
+
+	int get_mode(void) const { return mode; }
+	const char *data(void) const { return buf; }
+	int length(void) const { return used; }
+	void reset(void) { used = row_start = 0; }
+	/* reset, and start csv over with a header: for output that will be
+	 * spliced into a stream other Formatters write to as well */
+	void restart(void) { reset(); last_columns[0] = '\0'; }
+	/* csv: the columns of the last header line written, "" if none */
+	const char *header(void) const { return last_columns; }
+
+private:
+	void init(int mode);
+	void reserve(int n);
+	void put(char c) { reserve(1); buf[used++] = c; }
+	void put(const char *s, int n);
+	void put(const char *s);
+	void put_uint(unsigned int v);
+	void put_u64(unsigned long long v);
+	void put_hex(unsigned int v);
+	void put_escaped(const char *s);
+	bool key(const char *name, bool show);
+
+	int mode;
+	FILE *fp;
+	int fd;
+	char *buf;
+	int used, alloc;
+
+	/* per nesting level: no field written yet at this level? */
+	bool first[16];
+	int depth;
+	const char *layer;
+	const char *tag_name, *tag_value;
+
+	/* csv: where this record's row starts, and its column names */
+	int row_start;
+	char columns[1024], last_columns[1024];
+	int ncolumns;
+};
+
+#endif
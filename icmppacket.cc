@@ -100,24 +100,20 @@ Buffer ICMPPacket::to_buffer(void) const {
 	return ret;
 }
 
-void ICMPPacket::print(FILE *fp) const {
-	bool found = false;
-	fprintf(fp, "ICMP(");
+void ICMPPacket::format(Formatter &f) const {
+	const char *message = NULL;
 	for (int i=0; icmp_map[i].name; i++)
 		if (icmp_map[i].type == type && icmp_map[i].code == code) {
-			fprintf(fp, "message=%s", icmp_map[i].name);
-			found = true;
+			message = icmp_map[i].name;
 			break;
 		}
-	if (!found) fprintf(fp, "type=%d code=%d", type, code);
+	f.begin("ICMP");
+	f.field_str("message", message, message != NULL);
+	f.field("type", type, !message);
+	f.field("code", code, !message);
 	/* print checksum if wrong */
-	if (data.length > 0) {
-		fprintf(fp, " data=(");
-		for (int i=0; i<data.length; i++)
-			fprintf(fp, "%02x", data.data[i]);
-		fprintf(fp, ")");
-	}
-	fprintf(fp, ")");
+	f.field_data("data", data.data, data.length, data.length > 0);
+	f.end();
 }
 
 int ICMPPacket::get_length(void) const {
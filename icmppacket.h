@@ -31,7 +31,7 @@ public:
 	ICMPPacket(void);
 	ICMPPacket(const Buffer &b);
 	virtual Buffer to_buffer(void) const;
-	virtual void print(FILE *fp) const;
+	virtual void format(Formatter &f) const;
 	virtual int get_length(void) const;
 	virtual void set_field(const char *name, const char *value);
 	virtual void set_data(const Buffer &b);
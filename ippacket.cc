@@ -21,7 +21,6 @@
  */
 
 #include <ctype.h>
-#include <netdb.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
@@ -33,6 +32,7 @@
 #include "icmppacket.h"
 #include "ippacket.h"
 #include "packet.h"
+#include "resolve.h"
 #include "tcppacket.h"
 #include "token.h"
 #include "udppacket.h"
@@ -45,16 +45,7 @@ static Flag flag_map[] = {
 };
 
 IPPacket::IPPacket(void) {
-	char buf[256];
-	struct hostent *hent;
-	gethostname(buf, sizeof(buf));
-	hent = gethostbyname(buf);
-	if (hent)
-		memcpy(&src, hent->h_addr_list[0], sizeof(src));
-	else {
-		g_warning("IP: could not get host name to set default src");
-		bzero(&src, sizeof(src));
-	}
+	src = default_source();
 	bzero(&dst, sizeof(dst));
 	version = 4;
 	hlen = 5;
@@ -65,6 +56,7 @@ IPPacket::IPPacket(void) {
 }
 
 IPPacket::IPPacket(const Buffer &b) {
+	payload = NULL;
 	g_return_if_fail(b.length >= 20);
 	//printf("IPPacket(");
 	//b.print(20);
@@ -82,8 +74,10 @@ IPPacket::IPPacket(const Buffer &b) {
 	memcpy(&src, &b.data[12], 4);
 	memcpy(&dst, &b.data[16], 4);
 
-	if (len > 4*hlen) {
-		Buffer pb(b.data+4*hlen, len-4*hlen);
+	/* a capture may have cut the datagram short */
+	int avail = MIN(len, b.length);
+	if (avail > 4*hlen) {
+		Buffer pb(b.data+4*hlen, avail-4*hlen);
 		switch (protocol) {
 			case IP_IP:
 				payload = new IPPacket(pb);
@@ -134,31 +128,30 @@ Buffer IPPacket::to_buffer(void) const {
 }
 
 void IPPacket::print(FILE *fp) const {
-	fprintf(fp, "IP(");
-	if (version != 4) fprintf(fp, "version=%d ", version);
-	if (hlen != 5) fprintf(fp, "header_length=%d ", hlen);
-	if (tos) fprintf(fp, "tos=0x%x ", tos);
-	fprintf(fp, "length=%d identification=0x%x ", len, id);
-	if (flags) {
-		fprintf(fp, "flags=");
-		print_flags(fp, flags, flag_map);
-		fprintf(fp, " ");
-	}
-	if (frag_off) fprintf(fp, "fragment_offset=%d ", frag_off);
-	fprintf(fp, "ttl=%d ", ttl);
-	struct protoent *pe = getprotobynumber(protocol);
-	if (pe)
-		fprintf(fp, "protocol=%s ", pe->p_name);
-	else
-		fprintf(fp, "protocol=%d ", protocol);
+	Formatter f(fp, FORMAT_TEXT);
+	format(f);
+	f.end_record();
+}
+
+void IPPacket::format(Formatter &f) const {
+	f.begin("IP");
+	f.field("version", version, version != 4);
+	f.field("header_length", hlen, hlen != 5);
+	f.field_hex("tos", tos, tos != 0);
+	f.field("length", len);
+	f.field_hex("identification", id);
+	f.field_flags("flags", flags, flag_map, flags != 0);
+	f.field("fragment_offset", frag_off, frag_off != 0);
+	f.field("ttl", ttl);
+	f.field_symbol("protocol", protocol, protocol_name(protocol));
 	/* print the checksum if it's wrong */
-	fprintf(fp, "source=%s ", inet_ntoa(src));
-	fprintf(fp, "destination=%s", inet_ntoa(dst));
+	f.field_addr("source", src);
+	f.field_addr("destination", dst);
 	if (payload) {
-		fprintf(fp, " payload=");
-		payload->print(fp);
+		f.begin_payload("payload");
+		payload->format(f);
 	}
-	fprintf(fp, ")\n");
+	f.end();
 }
 
 int IPPacket::get_length(void) const {
@@ -188,11 +181,11 @@ void IPPacket::set_field(const char *name, const char *value) {
 		if (isdigit((int)value[0]))
 			protocol = parse_number(value);
 		else {
-			struct protoent *pe = getprotobyname(value);
-			if (!pe)
+			int number = protocol_number(value);
+			if (number < 0)
 				g_warning("Unknown protocol \"%s\"", value);
 			else
-				protocol = pe->p_proto;
+				protocol = number;
 		}
 	}
 	else if (!strcasecmp(name, "checksum")) checksum = parse_number(value);
@@ -221,13 +214,13 @@ int IPPacket::get_port(void) const {
 }
 
 void IPPacket::prepare(void) {
-	len = hlen*4 + payload->get_length();
+	len = get_length();
 	checksum = 0;
 	Buffer b = to_buffer();
 	b.length = hlen*4;
 	checksum = calculate_checksum(b);
 	if (payload) payload->prepare();
-	if (protocol == IP_TCP) {
+	if (protocol == IP_TCP && payload) {
 		Buffer pseudo(12+payload->get_length());
 		memcpy(&pseudo.data[0], &src, 4);
 		memcpy(&pseudo.data[4], &dst, 4);
@@ -240,7 +233,6 @@ void IPPacket::prepare(void) {
 		Buffer pb = payload->to_buffer();
 		memcpy(&pseudo.data[12], &pb.data[0], pb.length);
 		int cs = calculate_checksum(pseudo);
-		printf("Setting TCP's checksum to %d\n", cs);
 		((TCPPacket*)payload)->checksum = cs;
 	}
 }
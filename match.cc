@@ -0,0 +1,330 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "match.h"
+
+Matcher::Matcher(void) {
+	patterns = NULL;
+	npatterns = 0;
+	nclasses = nstates = 0;
+	delta = NULL;
+	out_start = out_ids = NULL;
+	nfirst = 0;
+	prefilter = false;
+	hits = NULL;
+}
+
+Matcher::~Matcher(void) {
+	for (int i=0; i<npatterns; i++) {
+		g_free(patterns[i].name);
+		g_free(patterns[i].bytes);
+	}
+	g_free(patterns);
+	g_free(delta);
+	g_free(out_start);
+	g_free(out_ids);
+	g_free(hits);
+}
+
+int Matcher::add(const char *name, const unsigned char *bytes, int len) {
+	patterns = g_renew(Pattern, patterns, npatterns+1);
+	Pattern *p = &patterns[npatterns];
+	p->name = g_strdup(name);
+	p->bytes = g_new(unsigned char, len);
+	memcpy(p->bytes, bytes, len);
+	p->len = len;
+	return npatterns++;
+}
+
+static int hex_value(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+bool Matcher::load(const char *filename) {
+	FILE *fp = fopen(filename, "r");
+	if (!fp) {
+		perror(filename);
+		return false;
+	}
+	char line[4096];
+	unsigned char bytes[4096];
+	int lineno = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		char *p = line;
+		while (isspace(*p)) p++;
+		if (*p == '\0' || *p == '#') continue;
+		char *name = p;
+		while (*p && !isspace(*p)) p++;
+		if (*p) *p++ = '\0';
+		while (isspace(*p)) p++;
+
+		int len = 0;
+		bool hex = false;
+		for (; *p && ok; p++) {
+			if (*p == '|')
+				hex = !hex;
+			else if (!hex)
+				bytes[len++] = *p;
+			else if (!isspace(*p)) {
+				int hi = hex_value(p[0]), lo = hi >= 0 ? hex_value(p[1]) : -1;
+				if (lo < 0) ok = false;
+				else {
+					bytes[len++] = hi << 4 | lo;
+					p++;
+				}
+			}
+		}
+		if (hex || len == 0) ok = false;
+		if (!ok)
+			fprintf(stderr, "%s:%d: bad signature\n", filename, lineno);
+		else
+			add(name, bytes, len);
+	}
+	fclose(fp);
+	return ok;
+}
+
+/* a trie node, while compiling */
+struct TrieNode {
+	int child, sibling;  /* first child, next sibling: -1 if none */
+	unsigned char byte;
+	int ends;  /* first signature ending here, -1 if none */
+};
+
+bool Matcher::compile(void) {
+	int i;
+	if (npatterns == 0) {
+		fprintf(stderr, "no signatures to match\n");
+		return false;
+	}
+
+	/* byte classes: one for each byte some signature uses, and class 0
+	 * for all the rest, if there are any */
+	bool used[256] = { false };
+	for (i=0; i<npatterns; i++)
+		for (int j=0; j<patterns[i].len; j++)
+			used[patterns[i].bytes[j]] = true;
+	int nused = 0;
+	for (i=0; i<256; i++)
+		if (used[i]) nused++;
+	nclasses = nused == 256 ? 0 : 1;
+	for (i=0; i<256; i++)
+		classes[i] = used[i] ? nclasses++ : 0;
+
+	/* the trie */
+	int nnodes = 1, alloc = 1024;
+	TrieNode *nodes = g_new(TrieNode, alloc);
+	int *next_end = g_new(int, npatterns);
+	nodes[0].child = nodes[0].sibling = nodes[0].ends = -1;
+	for (i=0; i<npatterns; i++) {
+		int n = 0;
+		for (int j=0; j<patterns[i].len; j++) {
+			unsigned char b = patterns[i].bytes[j];
+			int c = nodes[n].child;
+			while (c >= 0 && nodes[c].byte != b) c = nodes[c].sibling;
+			if (c < 0) {
+				if (nnodes == alloc) nodes = g_renew(TrieNode, nodes, alloc *= 2);
+				c = nnodes++;
+				nodes[c].child = nodes[c].ends = -1;
+				nodes[c].byte = b;
+				nodes[c].sibling = nodes[n].child;
+				nodes[n].child = c;
+			}
+			n = c;
+		}
+		next_end[i] = nodes[n].ends;
+		nodes[n].ends = i;
+	}
+	if ((long long)nnodes * nclasses >= (1LL << 31)) {
+		fprintf(stderr, "too many signatures: %d states\n", nnodes);
+		g_free(nodes);
+		g_free(next_end);
+		return false;
+	}
+
+	/* Breadth-first over the trie, numbering states as they are found.
+	 * A state's row starts as a copy of its failure state's (which is
+	 * shallower, so already done), then its own children override it. */
+	nstates = nnodes;
+	g_free(delta);
+	delta = g_new0(unsigned int, (size_t)nstates * nclasses);
+	int *node_of = g_new(int, nstates);  /* state -> trie node */
+	int *fail = g_new(int, nstates);
+	bool *accept = g_new0(bool, nstates);
+	node_of[0] = 0;
+	fail[0] = 0;
+	int found = 1;
+	for (int s=0; s<found; s++) {
+		unsigned int *row = delta + (size_t)s * nclasses;
+		if (s > 0)
+			memcpy(row, delta + (size_t)fail[s] * nclasses,
+				nclasses * sizeof(unsigned int));
+		for (int c=nodes[node_of[s]].child; c >= 0; c = nodes[c].sibling) {
+			int t = found++;
+			int cls = classes[nodes[c].byte];
+			node_of[t] = c;
+			fail[t] = s == 0 ? 0 : (row[cls] >> 1) / nclasses;
+			accept[t] = nodes[c].ends >= 0 || accept[fail[t]];
+			row[cls] = ((unsigned int)t * nclasses) << 1 | accept[t];
+		}
+	}
+
+	/* what each state reports: its own signatures, then its failure
+	 * state's */
+	g_free(out_start);
+	out_start = g_new(int, nstates + 1);
+	int total = 0;
+	for (int s=0; s<nstates; s++) {
+		int own = 0;
+		for (int p=nodes[node_of[s]].ends; p >= 0; p = next_end[p]) own++;
+		out_start[s] = own + (s > 0 ? out_start[fail[s]] : 0);  /* count */
+		total += out_start[s];
+	}
+	g_free(out_ids);
+	out_ids = g_new(int, total + 1);
+	int *count = out_start;
+	out_start = g_new(int, nstates + 1);
+	for (int s=0, at=0; s<nstates; s++) {
+		out_start[s] = at;
+		at += count[s];
+	}
+	out_start[nstates] = total;
+	for (int s=0; s<nstates; s++) {
+		int at = out_start[s];
+		for (int p=nodes[node_of[s]].ends; p >= 0; p = next_end[p])
+			out_ids[at++] = p;
+		if (s > 0)
+			for (int k=out_start[fail[s]]; k<out_start[fail[s]+1]; k++)
+				out_ids[at++] = out_ids[k];
+	}
+	g_free(count);
+
+	/* the prefilter needs few enough first bytes to compare against */
+	bool first_used[256] = { false };
+	nfirst = 0;
+	for (i=0; i<npatterns; i++)
+		first_used[patterns[i].bytes[0]] = true;
+	for (i=0; i<256; i++)
+		if (first_used[i]) {
+			if (nfirst == MATCH_PREFILTER_BYTES) {
+				nfirst = 0;
+				break;
+			}
+			first[nfirst++] = i;
+		}
+	prefilter = nfirst > 0;
+
+	g_free(hits);
+	hits = g_new0(unsigned long, npatterns);
+	g_free(nodes);
+	g_free(next_end);
+	g_free(node_of);
+	g_free(fail);
+	g_free(accept);
+	return true;
+}
+
+size_t Matcher::table_bytes(void) const {
+	return (size_t)nstates * nclasses * sizeof(unsigned int);
+}
+
+int Matcher::scan(const unsigned char *data, int len, MatchFn fn, void *arg) {
+	unsigned int row = 0;
+	int matches = 0;
+	bool skip = prefilter;
+#ifdef __SSE2__
+	__m128i want[MATCH_PREFILTER_BYTES];
+	for (int k=0; k<nfirst; k++)
+		want[k] = _mm_set1_epi8(first[k]);
+#endif
+
+	for (int i=0; i<len; i++) {
+		if (row == 0 && skip) {
+			/* at the root, nothing can start before one of the first bytes */
+#ifdef __SSE2__
+			for (; i + 16 <= len; i += 16) {
+				__m128i d = _mm_loadu_si128((const __m128i *)(data + i));
+				__m128i m = _mm_cmpeq_epi8(d, want[0]);
+				for (int k=1; k<nfirst; k++)
+					m = _mm_or_si128(m, _mm_cmpeq_epi8(d, want[k]));
+				int bits = _mm_movemask_epi8(m);
+				if (bits) {
+					i += __builtin_ctz(bits);
+					break;
+				}
+			}
+#endif
+			for (; i < len; i++) {
+				int k = 0;
+				while (k < nfirst && data[i] != first[k]) k++;
+				if (k < nfirst) break;
+			}
+			if (i == len) break;
+		}
+		unsigned int e = delta[row + classes[data[i]]];
+		row = e >> 1;
+		if (e & 1) {
+			int s = row / nclasses;
+			for (int k=out_start[s]; k<out_start[s+1]; k++) {
+				hits[out_ids[k]]++;
+				if (fn) fn(out_ids[k], i + 1, arg);
+				matches++;
+			}
+		}
+	}
+	return matches;
+}
+
+static const Matcher *sort_matcher;
+
+static int compare_hits(const void *a, const void *b) {
+	unsigned long x = sort_matcher->hits[*(const int *)a];
+	unsigned long y = sort_matcher->hits[*(const int *)b];
+	return x < y ? 1 : x > y ? -1 : *(const int *)a - *(const int *)b;
+}
+
+/* the signatures that matched, most often first */
+void Matcher::report(FILE *fp) const {
+	int n = 0, *ids = g_new(int, npatterns);
+	for (int i=0; i<npatterns; i++)
+		if (hits[i]) ids[n++] = i;
+	sort_matcher = this;
+	qsort(ids, n, sizeof(int), compare_hits);
+	fprintf(fp, "match: %d of %d signatures matched\n", n, npatterns);
+	for (int i=0; i<n; i++)
+		fprintf(fp, "  %-24s %lu\n", patterns[ids[i]].name, hits[ids[i]]);
+	g_free(ids);
+}
@@ -0,0 +1,94 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdio.h>
+
+/* Finds many byte signatures at once in packet payloads.  The signatures
+ * compile into an Aho-Corasick automaton, flattened to a DFA so that each
+ * byte costs one table load: there is no failure-link chasing while
+ * scanning.  To keep the table small and its hot part in cache, bytes
+ * that no signature tells apart share a column (so a row is as wide as
+ * the number of distinct signature bytes, plus one), and states are
+ * numbered breadth-first, so the shallow states that most bytes visit
+ * sit together at the front.  Each entry is the next state's row offset
+ * shifted left once, with the low bit set if that state ends a
+ * signature.
+ *
+ * When the signatures start with only a few distinct bytes, scanning
+ * from the root skips ahead to the next such byte 16 at a time with SSE2
+ * compares, where the CPU has them.
+ *
+ * A signature file has one signature a line, a name and then the bytes,
+ * Snort-style: text, with |..| around runs of hex bytes, e.g.
+ *   http-evil   GET /evil|0d 0a|
+ * Blank lines and lines starting with # are skipped. */
+
+#define MATCH_PREFILTER_BYTES 4
+
+/* id of the signature, and the payload offset just past where it ended */
+typedef void (*MatchFn)(int id, int end, void *arg);
+
+class Matcher {
+public:
+	Matcher(void);
+	~Matcher(void);
+	/* returns the signature's id */
+	int add(const char *name, const unsigned char *bytes, int len);
+	bool load(const char *filename);
+	bool compile(void);
+	/* counts each match in hits, and calls fn if there is one; returns
+	 * the number of matches */
+	int scan(const unsigned char *data, int len, MatchFn fn = NULL,
+		void *arg = NULL);
+	void report(FILE *fp) const;
+
+	int count(void) const { return npatterns; }
+	const char *name(int id) const { return patterns[id].name; }
+	int states(void) const { return nstates; }
+	size_t table_bytes(void) const;
+
+	bool prefilter;  /* may be turned off after compile() */
+	unsigned long *hits;
+
+private:
+	struct Pattern {
+		char *name;
+		unsigned char *bytes;
+		int len;
+	};
+	Pattern *patterns;
+	int npatterns;
+
+	/* the DFA */
+	unsigned char classes[256];
+	int nclasses, nstates;
+	unsigned int *delta;
+	int *out_start, *out_ids;  /* signatures ending at each state */
+
+	unsigned char first[MATCH_PREFILTER_BYTES];
+	int nfirst;
+};
+
+#endif
@@ -0,0 +1,355 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "metrics.h"
+
+#define METRICS_CLIENTS 16
+#define METRICS_IDLE_MS 5000
+
+MetricsServer::MetricsServer(void) {
+	metrics = NULL;
+	nmetrics = 0;
+	pages = NULL;
+	npages = 0;
+	fd = wake[0] = wake[1] = -1;
+	path = NULL;
+	running = false;
+}
+
+MetricsServer::~MetricsServer(void) {
+	stop();
+	if (fd >= 0) close(fd);
+	if (path) {
+		unlink(path);
+		g_free(path);
+	}
+	g_free(metrics);
+	g_free(pages);
+}
+
+static void nonblocking(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+bool MetricsServer::listen(const char *spec) {
+	if (strchr(spec, '/')) {
+		struct sockaddr_un sun;
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(spec) >= sizeof(sun.sun_path)) {
+			fprintf(stderr, "%s: socket path too long\n", spec);
+			return false;
+		}
+		strcpy(sun.sun_path, spec);
+		unlink(spec);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+				|| bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+			perror(spec);
+			return false;
+		}
+		path = g_strdup(spec);
+	}
+	else {
+		struct sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		const char *colon = strrchr(spec, ':');
+		if (colon) {
+			char *addr = g_strndup(spec, colon - spec);
+			bool ok = !*addr || inet_aton(addr, &sin.sin_addr);
+			g_free(addr);
+			if (!ok) {
+				fprintf(stderr, "%s: bad address\n", spec);
+				return false;
+			}
+			spec = colon + 1;
+		}
+		int port = atoi(spec);
+		if (port <= 0 || port > 65535) {
+			fprintf(stderr, "%s: bad port\n", spec);
+			return false;
+		}
+		sin.sin_port = htons(port);
+		int one = 1;
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+				|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+				|| bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+			perror("metrics: bind");
+			return false;
+		}
+	}
+	if (::listen(fd, 16) < 0) {
+		perror("metrics: listen");
+		return false;
+	}
+	nonblocking(fd);
+	return true;
+}
+
+MetricsServer::Metric *MetricsServer::add(const char *name, const char *help,
+		const char *labels, bool counter) {
+	metrics = g_renew(Metric, metrics, nmetrics+1);
+	Metric *m = &metrics[nmetrics++];
+	memset(m, 0, sizeof(*m));
+	m->name = name;
+	m->help = help;
+	m->labels = labels;
+	m->counter = counter;
+	return m;
+}
+
+void MetricsServer::counter(const char *name, const char *help,
+		const char *labels, const unsigned long *v) {
+	Metric *m = add(name, help, labels, true);
+	m->kind = Metric::ULONG;
+	m->v = v;
+}
+
+void MetricsServer::counter(const char *name, const char *help,
+		const char *labels, const unsigned long long *v) {
+	Metric *m = add(name, help, labels, true);
+	m->kind = Metric::ULLONG;
+	m->v = v;
+}
+
+void MetricsServer::gauge(const char *name, const char *help,
+		const char *labels, const int *v) {
+	Metric *m = add(name, help, labels, false);
+	m->kind = Metric::INT;
+	m->v = v;
+}
+
+void MetricsServer::gauge(const char *name, const char *help,
+		const char *labels, MetricFn fn, void *arg) {
+	Metric *m = add(name, help, labels, false);
+	m->kind = Metric::FN;
+	m->fn = fn;
+	m->arg = arg;
+}
+
+void MetricsServer::counter(const char *name, const char *help,
+		const char *labels, MetricFn fn, void *arg) {
+	Metric *m = add(name, help, labels, true);
+	m->kind = Metric::FN;
+	m->fn = fn;
+	m->arg = arg;
+}
+
+void MetricsServer::page(const char *path, PageFn fn, void *arg) {
+	pages = g_renew(Page, pages, npages+1);
+	Page *p = &pages[npages++];
+	p->path = path;
+	p->fn = fn;
+	p->arg = arg;
+}
+
+/* the exposition text, freshly read from the counters */
+char *MetricsServer::render(size_t *len) {
+	char *text;
+	FILE *fp = open_memstream(&text, len);
+	for (int i=0; i<nmetrics; i++) {
+		const Metric &m = metrics[i];
+		if (i == 0 || strcmp(m.name, metrics[i-1].name))
+			fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", m.name, m.help, m.name,
+				m.counter ? "counter" : "gauge");
+		fputs(m.name, fp);
+		if (m.labels) fprintf(fp, "{%s}", m.labels);
+		switch (m.kind) {
+			case Metric::ULONG:
+				fprintf(fp, " %lu\n",
+					__atomic_load_n((const unsigned long *)m.v, __ATOMIC_RELAXED));
+				break;
+			case Metric::ULLONG:
+				fprintf(fp, " %llu\n",
+					__atomic_load_n((const unsigned long long *)m.v, __ATOMIC_RELAXED));
+				break;
+			case Metric::INT:
+				fprintf(fp, " %d\n",
+					__atomic_load_n((const int *)m.v, __ATOMIC_RELAXED));
+				break;
+			case Metric::FN:
+				fprintf(fp, " %.9g\n", m.fn(m.arg));
+				break;
+		}
+	}
+	fclose(fp);
+	return text;
+}
+
+/* called once the request headers are in */
+void MetricsServer::respond(Client *c) {
+	char *body = NULL;
+	size_t len = 0;
+	const char *status = "404 Not Found";
+	char method[8], target[256];
+	if (sscanf(c->in, "%7s %255s", method, target) == 2) {
+		target[strcspn(target, "?")] = '\0';
+		if (!strcmp(method, "GET") && !strcmp(target, "/metrics")) {
+			status = "200 OK";
+			body = render(&len);
+		}
+		else if (!strcmp(method, "GET") || !strcmp(method, "POST"))
+			for (int i=0; i<npages; i++)
+				if (!strcmp(target, pages[i].path)) {
+					status = "200 OK";
+					FILE *fp = open_memstream(&body, &len);
+					pages[i].fn(fp, pages[i].arg);
+					fclose(fp);
+					break;
+				}
+	}
+	char *head = g_strdup_printf("HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %lu\r\nConnection: close\r\n\r\n",
+		status, (unsigned long)len);
+	size_t hlen = strlen(head);
+	c->out = (char *)g_malloc(hlen + len);
+	memcpy(c->out, head, hlen);
+	if (body) memcpy(c->out + hlen, body, len);
+	c->outlen = hlen + len;
+	c->outpos = 0;
+	g_free(head);
+	free(body);
+}
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void *MetricsServer::serve_thread(void *arg) {
+	MetricsServer *ms = (MetricsServer *)arg;
+	Client clients[METRICS_CLIENTS];
+	int nclients = 0;
+	struct pollfd pfd[METRICS_CLIENTS + 2];
+
+	for (;;) {
+		pfd[0].fd = ms->wake[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = ms->fd;
+		pfd[1].events = nclients < METRICS_CLIENTS ? POLLIN : 0;
+		/* wake for the first client to run out of time */
+		long long now = now_ms();
+		int timeout = -1;
+		for (int i=0; i<nclients; i++) {
+			pfd[i+2].fd = clients[i].fd;
+			pfd[i+2].events = clients[i].out ? POLLOUT : POLLIN;
+			int left = MAX(0, clients[i].deadline - now);
+			if (timeout < 0 || left < timeout) timeout = left;
+		}
+		if (poll(pfd, nclients + 2, timeout) < 0) {
+			if (errno == EINTR) continue;
+			perror("metrics: poll");
+			break;
+		}
+		if (pfd[0].revents) break;
+		now = now_ms();
+		for (int i=0; i<nclients; i++) {
+			Client *c = &clients[i];
+			bool done = false;
+			if (!pfd[i+2].revents) {
+				if (now < c->deadline) continue;
+				done = true;  /* too slow: give the slot to someone else */
+			}
+			else if (!c->out) {
+				int n = read(c->fd, c->in + c->inlen, sizeof(c->in) - 1 - c->inlen);
+				if (n <= 0)
+					done = n == 0 || errno != EAGAIN;
+				else {
+					c->inlen += n;
+					c->in[c->inlen] = '\0';
+					if (strstr(c->in, "\r\n\r\n") || strstr(c->in, "\n\n"))
+						ms->respond(c);
+					else if (c->inlen == sizeof(c->in) - 1)
+						done = true;  /* too long to be a scrape */
+				}
+			}
+			if (c->out && !done) {
+				ssize_t n = write(c->fd, c->out + c->outpos, c->outlen - c->outpos);
+				if (n > 0) c->outpos += n;
+				done = (n < 0 && errno != EAGAIN) || c->outpos == c->outlen;
+			}
+			if (done) {
+				close(c->fd);
+				g_free(c->out);
+				clients[i] = clients[--nclients];
+				pfd[i+2] = pfd[nclients+2];
+				i--;
+			}
+		}
+		/* after the clients, whose pollfds this round doesn't cover */
+		if (pfd[1].revents & POLLIN) {
+			int cfd = accept(ms->fd, NULL, NULL);
+			if (cfd >= 0) {
+				nonblocking(cfd);
+				Client *c = &clients[nclients++];
+				c->fd = cfd;
+				c->inlen = 0;
+				c->out = NULL;
+				c->deadline = now + METRICS_IDLE_MS;
+			}
+		}
+	}
+	for (int i=0; i<nclients; i++) {
+		close(clients[i].fd);
+		g_free(clients[i].out);
+	}
+	return NULL;
+}
+
+bool MetricsServer::start(void) {
+	if (pipe(wake) < 0) {
+		perror("pipe");
+		return false;
+	}
+	if (pthread_create(&thread, NULL, serve_thread, this)) {
+		perror("pthread_create");
+		return false;
+	}
+	running = true;
+	return true;
+}
+
+void MetricsServer::stop(void) {
+	if (!running) return;
+	char c = 0;
+	if (write(wake[1], &c, 1) < 0) perror("metrics: wake");
+	pthread_join(thread, NULL);
+	close(wake[0]);
+	close(wake[1]);
+	running = false;
+}
@@ -0,0 +1,108 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* Serves counters over HTTP in the Prometheus text format, from a thread
+ * of its own: one poll() loop over non-blocking sockets, listening on
+ * "[address:]port" (127.0.0.1 if no address) or on a unix socket if the
+ * spec holds a '/'.  GET /metrics answers; other paths can be added with
+ * page(), for simple control commands; anything else is a 404.  A client
+ * gets METRICS_IDLE_MS to send its request and take the answer, so idle
+ * connections can't hold every slot.
+ *
+ * The counters stay where their owners keep them, and are read in place
+ * with relaxed loads when a scrape comes in.  The threads that update
+ * them never take a lock or wait on the server.  Metrics with the same
+ * name should be registered one after another, differing in their
+ * labels; the HELP and TYPE lines go out once per name. */
+
+typedef double (*MetricFn)(void *arg);
+/* writes a page's body; runs on the server thread */
+typedef void (*PageFn)(FILE *fp, void *arg);
+
+class MetricsServer {
+public:
+	MetricsServer(void);
+	~MetricsServer(void);
+	bool listen(const char *spec);
+	/* labels, if any, look like worker="0" */
+	void counter(const char *name, const char *help, const char *labels,
+		const unsigned long *v);
+	void counter(const char *name, const char *help, const char *labels,
+		const unsigned long long *v);
+	void gauge(const char *name, const char *help, const char *labels,
+		const int *v);
+	/* fn runs on the server thread at every scrape */
+	void gauge(const char *name, const char *help, const char *labels,
+		MetricFn fn, void *arg);
+	void counter(const char *name, const char *help, const char *labels,
+		MetricFn fn, void *arg);
+	/* answer GET or POST of path, e.g. "/dump", with what fn writes */
+	void page(const char *path, PageFn fn, void *arg);
+	bool start(void);
+	void stop(void);
+
+private:
+	struct Metric {
+		const char *name, *help, *labels;
+		bool counter;
+		enum { ULONG, ULLONG, INT, FN } kind;
+		const void *v;
+		MetricFn fn;
+		void *arg;
+	};
+	struct Page {
+		const char *path;
+		PageFn fn;
+		void *arg;
+	};
+	struct Client {
+		int fd;
+		char in[2048];
+		int inlen;
+		char *out;
+		size_t outlen, outpos;
+		long long deadline;  /* ms on CLOCK_MONOTONIC, to be done by */
+	};
+
+	Metric *add(const char *name, const char *help, const char *labels,
+		bool counter);
+	char *render(size_t *len);
+	void respond(Client *c);
+	static void *serve_thread(void *arg);
+
+	Metric *metrics;
+	int nmetrics;
+	Page *pages;
+	int npages;
+	int fd, wake[2];
+	char *path;  /* of the unix socket, to remove */
+	pthread_t thread;
+	bool running;
+};
+
+#endif
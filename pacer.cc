@@ -0,0 +1,255 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <glib.h>
+#include "pacer.h"
+
+/* below this much remaining wait, spin instead of sleeping */
+#define SPIN_NS 50000
+
+nsec_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (nsec_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void sleep_until(nsec_t deadline) {
+	nsec_t now = monotonic_ns();
+	if (deadline - now > SPIN_NS) {
+		struct timespec ts;
+		nsec_t wake = deadline - SPIN_NS;
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	while (monotonic_ns() < deadline)
+		;
+}
+
+double parse_rate(const char *string) {
+	char *end;
+	double r = strtod(string, &end);
+	switch (*end) {
+		case 'k': case 'K': r *= 1e3; break;
+		case 'm': case 'M': r *= 1e6; break;
+		case 'g': case 'G': r *= 1e9; break;
+	}
+	return r;
+}
+
+Pacer::Pacer(double pps, double bps, int burst) {
+	this->pps = pps;
+	this->bps = bps;
+	this->burst = burst > 0 ? burst : 1;
+	ptokens = this->burst;
+	btokens = -1;  /* filled to capacity on the first wait() */
+	start = last_refill = last_send = 0;
+	ramp = RAMP_NONE;
+	ramp_from = ramp_to = 100;
+	ramp_ns = 0;
+	nsteps = 0;
+	step_at = NULL;
+	step_pct = NULL;
+	packets = 0;
+	bytes = 0;
+	waits = gaps = 0;
+	err_sum = err_max = gap_sum = gap_sumsq = 0;
+}
+
+Pacer::~Pacer(void) {
+	g_free(step_at);
+	g_free(step_pct);
+}
+
+/* "linear:FROM:TO:SECONDS" ramps from FROM% to TO% of the targets;
+ * "steps:PCT@SEC,PCT@SEC,..." holds each percentage from its offset on. */
+bool Pacer::set_ramp(const char *spec) {
+	if (!strncasecmp(spec, "linear:", 7)) {
+		double secs;
+		if (sscanf(spec+7, "%lf:%lf:%lf", &ramp_from, &ramp_to, &secs) != 3
+				|| secs <= 0)
+			return false;
+		ramp_ns = (nsec_t)(secs * 1e9);
+		ramp = RAMP_LINEAR;
+		return true;
+	}
+	if (!strncasecmp(spec, "steps:", 6)) {
+		const char *p = spec+6;
+		nsteps = 0;
+		while (p && *p) {
+			double pct, secs;
+			if (sscanf(p, "%lf@%lf", &pct, &secs) != 2) return false;
+			step_at = g_renew(nsec_t, step_at, nsteps+1);
+			step_pct = g_renew(double, step_pct, nsteps+1);
+			step_at[nsteps] = (nsec_t)(secs * 1e9);
+			step_pct[nsteps] = pct;
+			if (nsteps > 0 && step_at[nsteps] < step_at[nsteps-1]) return false;
+			nsteps++;
+			p = strchr(p, ',');
+			if (p) p++;
+		}
+		if (nsteps == 0) return false;
+		ramp = RAMP_STEPS;
+		return true;
+	}
+	return false;
+}
+
+double Pacer::scale(nsec_t t) const {
+	nsec_t off = t - start;
+	switch (ramp) {
+		case RAMP_LINEAR:
+			if (off >= ramp_ns) return ramp_to / 100;
+			return (ramp_from + (ramp_to - ramp_from) * off / ramp_ns) / 100;
+		case RAMP_STEPS: {
+			int i;
+			for (i=0; i<nsteps-1 && step_at[i+1] <= off; i++) ;
+			return step_pct[i] / 100;
+		}
+		default:
+			return 1;
+	}
+}
+
+/* Credit that piles up while we sleep for a packet is kept even past
+ * the bucket depth, so oversleeping doesn't cost rate; credit earned
+ * while the caller was busy elsewhere is capped at the burst size. */
+void Pacer::refill(nsec_t t, int bytes, bool capped) {
+	double dt = (t - last_refill) / 1e9;
+	double s = scale(t);
+	double bcap = (double)burst * bytes * 8;
+	ptokens += pps * s * dt;
+	btokens = btokens < 0 ? bcap : btokens + bps * s * dt;
+	if (capped) {
+		ptokens = MIN(ptokens, (double)burst);
+		btokens = MIN(btokens, bcap);
+	}
+	last_refill = t;
+}
+
+void Pacer::wait(int bytes) {
+	nsec_t t = monotonic_ns();
+	double bits = bytes * 8.0;
+
+	if (!active()) {
+		packets++;
+		this->bytes += bytes;
+		return;
+	}
+	if (packets == 0) start = last_refill = t;
+
+	for (bool capped = true;; capped = false) {
+		double s = scale(t), need = 0;
+		refill(t, bytes, capped);
+		if (pps > 0 && ptokens < 1)
+			need = MAX(need, s > 0 ? (1 - ptokens) / (pps * s) : 1e-3);
+		if (bps > 0 && btokens < bits)
+			need = MAX(need, s > 0 ? (bits - btokens) / (bps * s) : 1e-3);
+		if (need <= 0) break;
+
+		nsec_t deadline = t + (nsec_t)(need * 1e9) + 1;
+		sleep_until(deadline);
+		t = monotonic_ns();
+		note_error((t - deadline) / 1e3);
+	}
+	ptokens -= 1;
+	btokens -= bits;
+
+	if (packets > 0) {
+		double gap = (t - last_send) / 1e3;
+		gap_sum += gap;
+		gap_sumsq += gap * gap;
+		gaps++;
+	}
+	last_send = t;
+	packets++;
+	this->bytes += bytes;
+}
+
+void Pacer::note_error(double us) {
+	err_sum += us;
+	if (us > err_max) err_max = us;
+	waits++;
+}
+
+double Pacer::error_sum(void) const {
+	double v;
+	__atomic_load(&err_sum, &v, __ATOMIC_RELAXED);
+	return v;
+}
+
+double Pacer::error_max(void) const {
+	double v;
+	__atomic_load(&err_max, &v, __ATOMIC_RELAXED);
+	return v;
+}
+
+unsigned long Pacer::error_count(void) const {
+	return __atomic_load_n(&waits, __ATOMIC_RELAXED);
+}
+
+/* Fold another pacer's statistics into this one, as if both had paced
+ * one stream: used to total up per-worker pacers. */
+void Pacer::merge(const Pacer &other) {
+	if (other.packets == 0) return;
+	if (packets == 0 || other.start < start) start = other.start;
+	if (other.last_send > last_send) last_send = other.last_send;
+	pps += other.pps;
+	bps += other.bps;
+	packets += other.packets;
+	bytes += other.bytes;
+	waits += other.waits;
+	err_sum += other.err_sum;
+	err_max = MAX(err_max, other.err_max);
+	gaps += other.gaps;
+	gap_sum += other.gap_sum;
+	gap_sumsq += other.gap_sumsq;
+}
+
+void Pacer::report(FILE *fp) const {
+	double secs = (last_send - start) / 1e9;
+	if (packets < 2 || secs <= 0) {
+		fprintf(fp, "pacer: %lu packets, too few to measure a rate\n", packets);
+		return;
+	}
+	double mean_gap = gap_sum / gaps;
+	double var = gap_sumsq / gaps - mean_gap * mean_gap;
+	fprintf(fp, "pacer: %lu packets, %llu bytes in %.3f s\n", packets, bytes, secs);
+	fprintf(fp, "pacer: achieved %.0f pps, %.0f bps", (packets-1) / secs,
+		bytes * 8.0 / secs);
+	if (pps > 0) fprintf(fp, " (target %.0f pps)", pps);
+	if (bps > 0) fprintf(fp, " (target %.0f bps)", bps);
+	fprintf(fp, "\n");
+	fprintf(fp, "pacer: inter-packet gap %.3f us, jitter %.3f us\n", mean_gap,
+		var > 0 ? sqrt(var) : 0.0);
+	if (waits > 0)
+		fprintf(fp, "pacer: pacing error mean %.3f us, max %.3f us over %lu waits\n",
+			err_sum / waits, err_max, waits);
+}
@@ -0,0 +1,85 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdio.h>
+
+typedef long long nsec_t;
+
+nsec_t monotonic_ns(void);
+/* Sleep until an absolute CLOCK_MONOTONIC deadline: clock_nanosleep for
+ * the bulk of the wait, then spin out the last few microseconds. */
+void sleep_until(nsec_t deadline);
+double parse_rate(const char *string);
+
+/* Holds a sender to a packet rate and/or a bit rate with a token bucket
+ * for each.  A ramp profile scales both targets over time. */
+class Pacer {
+public:
+	Pacer(double pps, double bps, int burst);
+	~Pacer(void);
+	bool set_ramp(const char *spec);
+	bool active(void) const { return pps > 0 || bps > 0; }
+	void wait(int bytes);
+	/* count lateness, in microseconds, against a release time kept
+	 * elsewhere, as replay does */
+	void note_error(double us);
+	void merge(const Pacer &other);
+	void report(FILE *fp) const;
+	/* pacing error so far, in microseconds; these may be read from
+	 * another thread while the pacer runs */
+	double error_sum(void) const;
+	double error_max(void) const;
+	unsigned long error_count(void) const;
+
+	unsigned long packets;
+	unsigned long long bytes;
+
+private:
+	double scale(nsec_t t) const;
+	void refill(nsec_t t, int bytes, bool capped);
+
+	double pps, bps;
+	int burst;
+	double ptokens, btokens;
+	nsec_t start, last_refill, last_send;
+
+	/* ramp: linear from ramp_from to ramp_to percent over ramp_ns,
+	 * or a step schedule of (offset, percent) pairs */
+	enum { RAMP_NONE, RAMP_LINEAR, RAMP_STEPS } ramp;
+	double ramp_from, ramp_to;
+	nsec_t ramp_ns;
+	int nsteps;
+	nsec_t *step_at;
+	double *step_pct;
+
+	/* pacing error is lateness against the computed release time;
+	 * jitter is the spread of inter-departure gaps */
+	unsigned long waits;
+	double err_sum, err_max;
+	double gap_sum, gap_sumsq;
+	unsigned long gaps;
+};
+
+#endif
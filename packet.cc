@@ -93,6 +93,104 @@ Packet *parse(FILE *fp) {
 	return ret;
 }
 
+static Packet *new_packet(const Token &t) {
+	if (t.len == 4 && !strncasecmp(t.str, "ICMP", 4))
+		return new ICMPPacket();
+	if (t.len == 2 && !strncasecmp(t.str, "IP", 2))
+		return new IPPacket();
+	if (t.len == 3 && !strncasecmp(t.str, "TCP", 3))
+		return new TCPPacket();
+	if (t.len == 3 && !strncasecmp(t.str, "UDP", 3))
+		return new UDPPacket();
+	if (t.len > 0)
+		g_warning("Invalid packet code \"%.*s\".  Ignoring it.", t.len, t.str);
+	return NULL;
+}
+
+/* Copy a token into a fixed-size NUL-terminated buffer. */
+static const char *token_str(const Token &t, char *buf, int size) {
+	int n = t.len;
+	if (n >= size) {
+		g_warning("\"%.*s...\" is too long; truncating it", 20, t.str);
+		n = size-1;
+	}
+	memcpy(buf, t.str, n);
+	buf[n] = '\0';
+	return buf;
+}
+
+/* Same language as parse(FILE*), read from a mapped SpecFile.  Nested
+ * payloads are kept on an explicit stack rather than by recursing, so
+ * nesting depth is limited only by memory. */
+Packet *parse(SpecFile &sf) {
+	Packet **stack = NULL;
+	int depth = 0, alloc = 0;
+	Packet *ret = NULL;
+
+	Packet *p = new_packet(sf.next_token(TOK_SPACE|TOK_CLOSE, TOK_OPEN, true));
+	while (p) {
+		if (depth == alloc) {
+			alloc = alloc ? alloc*2 : 8;
+			stack = g_renew(Packet*, stack, alloc);
+		}
+		stack[depth++] = p;
+		p = NULL;
+
+		while (depth > 0 && !p) {
+			Packet *top = stack[depth-1];
+			Token key = sf.next_token(TOK_SPACE, TOK_EQUALS|TOK_CLOSE, false);
+			while (key.len > 0 && (key.str[key.len-1] == ' '
+					|| key.str[key.len-1] == '\t'))
+				key.len--;
+			if (key.len == 0) {
+				/* ')' closes the innermost packet; so does end of file */
+				sf.skip();
+				if (--depth == 0)
+					ret = top;
+				else
+					stack[depth-1]->set_payload(top);
+				continue;
+			}
+			if (sf.peek() != '=') {
+				g_warning("No value for field \"%.*s\"", key.len, key.str);
+				continue;
+			}
+			sf.skip();
+
+			if (key.len == 7 && !strncasecmp(key.str, "payload", 7)) {
+				Token t = sf.next_token(TOK_SPACE|TOK_CLOSE, TOK_OPEN, true);
+				p = new_packet(t);
+				if (!p && t.len > 0) {
+					/* skip the bad packet's body, nested parentheses and all */
+					int nest = 1;
+					while (nest > 0 && !sf.at_end()) {
+						int c = sf.peek();
+						if (c == '(') nest++;
+						else if (c == ')') nest--;
+						sf.skip();
+					}
+				}
+			}
+			else if (key.len == 4 && !strncasecmp(key.str, "data", 4)) {
+				Token t = sf.next_token(TOK_SPACE|TOK_OPEN, TOK_CLOSE, true);
+				Buffer b(t.len/2);
+				for (int i=0; i+1<t.len; i+=2)
+					b.data[i/2] = (hex_digit(t.str[i])<<4) + hex_digit(t.str[i+1]);
+				top->set_data(b);
+			}
+			else {
+				char name[64], value[256];
+				Token t = sf.next_token(0, TOK_SPACE|TOK_CLOSE, false);
+				top->set_field(token_str(key, name, sizeof(name)),
+					token_str(t, value, sizeof(value)));
+			}
+		}
+	}
+
+	g_free(stack);
+	return ret;
+}
+
 static unsigned int cksum(const unsigned short *ptr, int nbytes) {
 	long sum = 0;
 	u_short oddbyte;
@@ -117,6 +215,21 @@ unsigned int calculate_checksum(const Buffer &b) {
 	return ((sum & 0xFF) << 8) + ((sum & 0xFF00) >> 8);
 }
 
+/* Fix up a checksum after one 16-bit word it covers changed from
+ * old_word to new_word, without summing the rest again (RFC 1624). */
+unsigned int adjust_checksum(unsigned int sum, unsigned int old_word,
+		unsigned int new_word) {
+	unsigned long s = (~sum & 0xFFFF) + (~old_word & 0xFFFF) + new_word;
+	s = (s & 0xFFFF) + (s >> 16);
+	s = (s & 0xFFFF) + (s >> 16);
+	return ~s & 0xFFFF;
+}
+
+void Packet::print(FILE *fp) const {
+	Formatter f(fp, FORMAT_TEXT);
+	format(f);
+}
+
 void Packet::set_payload(Packet *payload) {
 	g_warning("set_payload not implemented for this packet type.");
 	delete payload;
@@ -25,12 +25,14 @@
 
 #include <stdio.h>
 #include "buffer.h"
+#include "format.h"
 
 class Packet {
 public:
 	virtual ~Packet(void) { }
 	virtual Buffer to_buffer(void) const = 0;
-	virtual void print(FILE *fp) const = 0;
+	virtual void print(FILE *fp) const;
+	virtual void format(Formatter &f) const = 0;
 	virtual int get_length(void) const = 0;
 	virtual void set_field(const char *name, const char *value) = 0;
 	virtual void set_data(const Buffer &b);
@@ -40,7 +42,12 @@ public:
 	virtual void prepare(void);
 };
 
+class SpecFile;
+
 Packet *parse(FILE *fp);  /* factory! */
+Packet *parse(SpecFile &sf);
 unsigned int calculate_checksum(const Buffer &b);
+unsigned int adjust_checksum(unsigned int sum, unsigned int old_word,
+	unsigned int new_word);
 
 #endif
@@ -0,0 +1,256 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "ether.h"
+#include "pcap.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+PcapFile::PcapFile(const char *filename) {
+	struct stat st;
+	int fd;
+
+	base = pos = limit = NULL;
+	size = 0;
+	linktype = snaplen = 0;
+	swapped = nsec = false;
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		perror(filename);
+		return;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < 24) {
+		g_warning("%s: not a pcap file", filename);
+		close(fd);
+		return;
+	}
+	size = st.st_size;
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(filename);
+		return;
+	}
+	madvise(p, size, MADV_SEQUENTIAL);
+	base = (const unsigned char*)p;
+
+	unsigned int magic;
+	memcpy(&magic, base, 4);
+	if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC)
+		swapped = false;
+	else if (GUINT32_SWAP_LE_BE(magic) == PCAP_MAGIC
+			|| GUINT32_SWAP_LE_BE(magic) == PCAP_MAGIC_NSEC)
+		swapped = true;
+	else {
+		g_warning("%s: not a pcap file", filename);
+		munmap(p, size);
+		base = NULL;
+		return;
+	}
+	nsec = get32(base) == PCAP_MAGIC_NSEC;
+	snaplen = get32(base+16);
+	linktype = get32(base+20);
+	pos = base + 24;
+	limit = base + size;
+}
+
+PcapFile::~PcapFile(void) {
+	if (base) munmap((void*)base, size);
+}
+
+unsigned int PcapFile::get32(const unsigned char *p) const {
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return swapped ? GUINT32_SWAP_LE_BE(v) : v;
+}
+
+bool PcapFile::next(PcapRecord *rec) {
+	if (!base || pos + 16 > limit) return false;
+	unsigned int sec = get32(pos), frac = get32(pos+4);
+	rec->ts = (long long)sec * 1000000000LL + (nsec ? frac : frac * 1000LL);
+	unsigned int caplen = get32(pos+8);
+	if (caplen > PCAP_MAX_CAPLEN) {
+		g_warning("pcap: bad record length %u at offset %ld", caplen,
+			(long)(pos - base));
+		pos = limit;
+		return false;
+	}
+	if (caplen > (size_t)(limit - pos - 16)) {
+		g_warning("pcap: truncated record at offset %ld", (long)(pos - base));
+		pos = limit;
+		return false;
+	}
+	rec->caplen = caplen;
+	rec->len = get32(pos+12);
+	rec->data = pos + 16;
+	pos += 16 + rec->caplen;
+	return true;
+}
+
+bool PcapFile::seek(size_t offset) {
+	if (!base || offset < 24 || base + offset > limit) return false;
+	pos = base + offset;
+	return true;
+}
+
+/* Could a record header start at p?  Its timestamp should be within a
+ * day of 'sec', and its lengths should fit the file and the snaplen. */
+bool PcapFile::plausible(const unsigned char *p, unsigned int sec) const {
+	if (p + 16 > limit) return false;
+	unsigned int t = get32(p), frac = get32(p+4);
+	unsigned int caplen = get32(p+8), len = get32(p+12);
+	unsigned int max = snaplen > 0 && snaplen < PCAP_MAX_CAPLEN ? snaplen
+		: PCAP_MAX_CAPLEN;
+	return (t > sec ? t - sec : sec - t) < 86400
+		&& frac < (nsec ? 1000000000U : 1000000U)
+		&& caplen <= max && caplen <= len && len <= PCAP_MAX_CAPLEN
+		&& p + 16 + caplen <= limit;
+}
+
+/* Moves to the first record boundary at or after 'offset', for splitting
+ * a file between readers.  A boundary is taken where four records in a
+ * row (or all that remain) look plausible; two readers that sync to the
+ * same place always agree on it. */
+bool PcapFile::sync(size_t offset) {
+	if (!base) return false;
+	if (offset <= 24) {
+		rewind();
+		return true;
+	}
+	for (const unsigned char *p = base + offset; p + 16 <= limit; p++) {
+		const unsigned char *q = p;
+		unsigned int sec = get32(p);
+		int n;
+		for (n=0; n<4 && plausible(q, sec); n++)
+			q += 16 + get32(q+8);
+		if (n == 4 || (n > 0 && q == limit)) {
+			pos = p;
+			return true;
+		}
+	}
+	pos = limit;
+	return false;
+}
+
+PcapWriter::PcapWriter(const char *filename, int linktype, int snaplen) {
+	offset = 0;
+	records = 0;
+	this->snaplen = snaplen;
+	if (!(fp = fopen(filename, "w"))) {
+		perror(filename);
+		return;
+	}
+	unsigned int header[6] = { PCAP_MAGIC_NSEC, 2 | (4 << 16), 0, 0,
+		(unsigned int)snaplen, (unsigned int)linktype };
+	fwrite(header, 1, 24, fp);
+	offset = 24;
+}
+
+PcapWriter::~PcapWriter(void) {
+	if (fp) fclose(fp);
+}
+
+long PcapWriter::write(long long ts, const unsigned char *data, int caplen,
+		int len) {
+	if (!fp) return -1;
+	if (caplen > snaplen) caplen = snaplen;
+	unsigned int header[4] = { (unsigned int)(ts / 1000000000LL),
+		(unsigned int)(ts % 1000000000LL), (unsigned int)caplen, (unsigned int)len };
+	fwrite(header, 1, 16, fp);
+	if (fwrite(data, 1, caplen, fp) != (size_t)caplen)
+		perror("PcapWriter: write");
+	long at = offset;
+	offset += 16 + caplen;
+	records++;
+	return at;
+}
+
+void PcapWriter::flush(void) {
+	if (fp) fflush(fp);
+}
+
+const unsigned char *frame_ip(const unsigned char *frame, int caplen,
+		int linktype, int *len) {
+	int off;
+	EtherFrame ef;
+	switch (linktype) {
+		case LINK_ETHERNET:
+			if (ether_classify(frame, caplen, &ef) != ETHER_IPV4) return NULL;
+			off = ef.payload - frame;
+			break;
+		case LINK_LINUX_SLL:
+			if (caplen < 16 || frame[14] != 0x08 || frame[15] != 0x00) return NULL;
+			off = 16;
+			break;
+		case LINK_RAW:
+		case LINK_IPV4:
+			off = 0;
+			break;
+		default:
+			return NULL;
+	}
+	if (caplen - off < 20 || (frame[off] >> 4) != 4) return NULL;
+	*len = caplen - off;
+	return frame + off;
+}
+
+bool ip_flow(const unsigned char *ip, int len, FlowKey *key) {
+	int hlen = (ip[0] & 0x0F) * 4;
+	if (len < 20 || hlen < 20 || hlen > len) return false;
+	memcpy(&key->src, ip+12, 4);
+	memcpy(&key->dst, ip+16, 4);
+	key->protocol = ip[9];
+	key->sport = key->dport = 0;
+	int frag_off = ((ip[6] & 0x1F) << 8) | ip[7];
+	if (frag_off == 0 && (key->protocol == 6 || key->protocol == 17)
+			&& len >= hlen + 4) {
+		key->sport = (ip[hlen] << 8) | ip[hlen+1];
+		key->dport = (ip[hlen+2] << 8) | ip[hlen+3];
+	}
+	return true;
+}
+
+const unsigned char *ip_payload(const unsigned char *ip, int len, int *plen) {
+	int hlen = (ip[0] & 0x0F) * 4;
+	if (len < 20 || hlen < 20 || hlen > len) return NULL;
+	int frag_off = ((ip[6] & 0x1F) << 8) | ip[7];
+	if (frag_off != 0) return NULL;
+	int total = (ip[2] << 8) | ip[3];
+	if (total < len) len = total;  /* Ethernet padding */
+	int off;
+	if (ip[9] == 6 && len >= hlen + 20)
+		off = hlen + (ip[hlen+12] >> 4) * 4;
+	else if (ip[9] == 17 && len >= hlen + 8)
+		off = hlen + 8;
+	else
+		return NULL;
+	if (off > len) return NULL;
+	*plen = len - off;
+	return ip + off;
+}
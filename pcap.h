@@ -0,0 +1,100 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+/* link-layer header types, as numbered in pcap file headers */
+enum { LINK_ETHERNET=1, LINK_RAW=101, LINK_LINUX_SLL=113, LINK_IPV4=228 };
+
+/* no record is believed longer than this, whatever its header says */
+#define PCAP_MAX_CAPLEN 262144
+
+struct PcapRecord {
+	long long ts;  /* nanoseconds since the epoch */
+	const unsigned char *data;
+	int caplen, len;
+};
+
+/* A pcap capture file, mapped read-only and walked in place. */
+class PcapFile {
+public:
+	PcapFile(const char *filename);
+	~PcapFile(void);
+	bool ok(void) const { return base != NULL; }
+	bool next(PcapRecord *rec);
+	void rewind(void) { pos = base + 24; }
+	size_t tell(void) const { return pos - base; }
+	bool seek(size_t offset);
+	bool sync(size_t offset);
+	size_t length(void) const { return size; }
+
+	int linktype, snaplen;
+
+private:
+	unsigned int get32(const unsigned char *p) const;
+	bool plausible(const unsigned char *p, unsigned int sec) const;
+
+	const unsigned char *base, *pos, *limit;
+	size_t size;
+	bool swapped, nsec;
+};
+
+/* Writes a nanosecond-resolution pcap file through stdio. */
+class PcapWriter {
+public:
+	PcapWriter(const char *filename, int linktype, int snaplen = 65535);
+	~PcapWriter(void);
+	bool ok(void) const { return fp != NULL; }
+	/* returns the offset the record was written at */
+	long write(long long ts, const unsigned char *data, int caplen, int len);
+	void flush(void);
+
+	long offset;  /* bytes written so far */
+	unsigned long records;
+
+private:
+	FILE *fp;
+	int snaplen;
+};
+
+/* Addresses, protocol and ports of an IPv4 datagram; ports are zero
+ * unless it is TCP or UDP and not a later fragment. */
+struct FlowKey {
+	struct in_addr src, dst;
+	int protocol, sport, dport;
+};
+
+/* Find the IPv4 datagram in a captured frame.  Returns NULL if there
+ * isn't one; otherwise sets *len to the captured length from there on. */
+const unsigned char *frame_ip(const unsigned char *frame, int caplen,
+	int linktype, int *len);
+bool ip_flow(const unsigned char *ip, int len, FlowKey *key);
+/* The TCP or UDP data in an IPv4 datagram, as far as it was captured.
+ * Returns NULL for other protocols and for later fragments. */
+const unsigned char *ip_payload(const unsigned char *ip, int len, int *plen);
+
+#endif
@@ -0,0 +1,293 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib.h>
+#include "pipeline.h"
+
+enum { BATCH_FREE, BATCH_FILLING, BATCH_QUEUED, BATCH_DONE };
+
+#define SLOT(seq) ((seq) & (PIPELINE_SLOTS - 1))
+
+static long long now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* spin, then yield, then sleep longer and longer, up to a millisecond:
+ * call with *spins zeroed after each wait */
+static void backoff(int *spins) {
+	int n = (*spins)++;
+	if (n < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+	else if (n < 128)
+		sched_yield();
+	else {
+		int shift = n - 128 < 5 ? n - 128 : 5;
+		struct timespec t = { 0, 32000L << shift };
+		nanosleep(&t, NULL);
+	}
+}
+
+Pipeline::Pipeline(int workers, int mode, int fd, PipelineFn fn, void *arg) {
+	nworkers = workers < 1 ? 1 : workers > PIPELINE_WORKERS ? PIPELINE_WORKERS
+		: workers;
+	this->fn = fn;
+	this->arg = arg;
+	this->fd = fd;
+	next_seq = out_seq = 0;
+	stall_ns = wait_ns = 0;
+	running = stopping = false;
+	for (int i=0; i<PIPELINE_SLOTS; i++) {
+		slots[i].state = BATCH_FREE;
+		slots[i].count = slots[i].used = 0;
+		slots[i].arena = g_new(unsigned char, PIPELINE_ARENA);
+		slots[i].out = new Formatter(mode);
+	}
+	pool = (Worker *)aligned_alloc(64, nworkers * sizeof(Worker));
+	memset(pool, 0, nworkers * sizeof(Worker));
+	int started = 0;
+	for (; started<nworkers; started++) {
+		Worker *w = &pool[started];
+		w->pipe = this;
+		snprintf(w->label, sizeof(w->label), "worker=\"%d\"", started);
+		if ((errno = pthread_create(&w->thread, NULL, work_thread, w)) != 0)
+			break;
+	}
+	if (started == nworkers
+			&& (errno = pthread_create(&writer, NULL, output_thread, this)) == 0) {
+		running = true;
+		return;
+	}
+	perror("pipeline: pthread_create");
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	for (int i=0; i<started; i++)
+		pthread_join(pool[i].thread, NULL);
+}
+
+Pipeline::~Pipeline(void) {
+	stop();
+	for (int i=0; i<PIPELINE_SLOTS; i++) {
+		g_free(slots[i].arena);
+		delete slots[i].out;
+	}
+	free(pool);
+}
+
+void Pipeline::stop(void) {
+	if (!running) return;
+	flush();
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	for (int i=0; i<nworkers; i++)
+		pthread_join(pool[i].thread, NULL);
+	pthread_join(writer, NULL);
+	running = false;
+}
+
+/* the batch being filled, waiting for output to free its slot if need be */
+Pipeline::Batch *Pipeline::filling(void) {
+	Batch *b = &slots[SLOT(next_seq)];
+	if (__atomic_load_n(&b->state, __ATOMIC_RELAXED) == BATCH_FILLING) return b;
+	if (__atomic_load_n(&b->state, __ATOMIC_ACQUIRE) != BATCH_FREE) {
+		long long t = now_ns();
+		int spins = 0;
+		while (__atomic_load_n(&b->state, __ATOMIC_ACQUIRE) != BATCH_FREE)
+			backoff(&spins);
+		__atomic_store_n(&stall_ns, stall_ns + (now_ns() - t), __ATOMIC_RELAXED);
+	}
+	b->count = b->used = 0;
+	__atomic_store_n(&b->state, BATCH_FILLING, __ATOMIC_RELAXED);
+	return b;
+}
+
+void Pipeline::add(long long ts, const unsigned char *frame, int len,
+		int source, int note, void *ptr) {
+	if (len > PIPELINE_ARENA) len = PIPELINE_ARENA;
+	Batch *b = filling();
+	if (b->used + len > PIPELINE_ARENA) {
+		dispatch();
+		b = filling();
+	}
+	PipelineItem *it = &b->items[b->count++];
+	memcpy(b->arena + b->used, frame, len);
+	it->ts = ts;
+	it->frame = b->arena + b->used;
+	it->len = len;
+	it->source = source;
+	it->note = note;
+	it->ptr = ptr;
+	b->used += len;
+	if (b->count == PIPELINE_BATCH) dispatch();
+}
+
+void Pipeline::flush(void) {
+	dispatch();
+}
+
+/* queue the batch being filled at the least busy worker */
+void Pipeline::dispatch(void) {
+	Batch *b = &slots[SLOT(next_seq)];
+	if (__atomic_load_n(&b->state, __ATOMIC_RELAXED) != BATCH_FILLING
+			|| b->count == 0)
+		return;
+	Worker *w = &pool[0];
+	int depth = queue_depth(0);
+	for (int i=1; i<nworkers && depth > 0; i++) {
+		int d = queue_depth(i);
+		if (d < depth) {
+			depth = d;
+			w = &pool[i];
+		}
+	}
+	/* there are never more batches queued than slots, so the ring has room */
+	w->ring[w->tail % PIPELINE_SLOTS] = SLOT(next_seq);
+	__atomic_store_n(&b->state, BATCH_QUEUED, __ATOMIC_RELAXED);
+	__atomic_store_n(&w->tail, w->tail + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&next_seq, next_seq + 1, __ATOMIC_RELEASE);
+}
+
+void *Pipeline::work_thread(void *arg) {
+	Worker *w = (Worker *)arg;
+	Pipeline *p = w->pipe;
+	int spins = 0;
+	for (;;) {
+		if (w->head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE)
+					&& w->head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE))
+				return NULL;
+			backoff(&spins);
+			continue;
+		}
+		spins = 0;
+		long long t = now_ns();
+		Batch *b = &p->slots[w->ring[w->head % PIPELINE_SLOTS]];
+		b->out->restart();
+		for (int i=0; i<b->count; i++)
+			p->fn(*b->out, b->items[i], p->arg);
+		__atomic_store_n(&b->state, BATCH_DONE, __ATOMIC_RELEASE);
+		__atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&w->batches, w->batches + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->busy_ns, w->busy_ns + (now_ns() - t),
+			__ATOMIC_RELAXED);
+	}
+}
+
+static void write_all(int fd, const char *data, int len) {
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("write");
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+void *Pipeline::output_thread(void *arg) {
+	Pipeline *p = (Pipeline *)arg;
+	int spins = 0;
+	long long waiting = 0;
+	char columns[1024] = "";  /* csv: as last written */
+	for (;;) {
+		Batch *b = &p->slots[SLOT(p->out_seq)];
+		if (__atomic_load_n(&b->state, __ATOMIC_ACQUIRE) == BATCH_DONE) {
+			if (waiting) {
+				__atomic_store_n(&p->wait_ns, p->wait_ns + (now_ns() - waiting),
+					__ATOMIC_RELAXED);
+				waiting = 0;
+			}
+			spins = 0;
+			const char *data = b->out->data();
+			int len = b->out->length();
+			if (b->out->get_mode() == FORMAT_CSV && b->out->header()[0]) {
+				/* each batch starts with a header; drop it when the one
+				 * before ended with the same columns */
+				int n = strlen(columns);
+				if (n && len > n+1 && data[0] == '#' && data[n+1] == '\n'
+						&& !memcmp(data+1, columns, n)) {
+					data += n+2;
+					len -= n+2;
+				}
+				strcpy(columns, b->out->header());
+			}
+			write_all(p->fd, data, len);
+			b->out->reset();
+			__atomic_store_n(&b->state, BATCH_FREE, __ATOMIC_RELEASE);
+			__atomic_store_n(&p->out_seq, p->out_seq + 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		bool stopping = __atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE);
+		bool behind = p->out_seq != __atomic_load_n(&p->next_seq, __ATOMIC_ACQUIRE);
+		if (stopping && !behind) return NULL;
+		/* only time spent waiting on the workers counts */
+		if (behind && !waiting) waiting = now_ns();
+		backoff(&spins);
+	}
+}
+
+int Pipeline::queue_depth(int i) const {
+	const Worker *w = &pool[i];
+	return __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)
+		- __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+}
+
+int Pipeline::reorder_depth(void) const {
+	unsigned long first = __atomic_load_n(&out_seq, __ATOMIC_RELAXED);
+	unsigned long last = __atomic_load_n(&next_seq, __ATOMIC_RELAXED);
+	int n = 0;
+	for (unsigned long s=first+1; s<last && s<first+PIPELINE_SLOTS; s++)
+		if (__atomic_load_n(&slots[SLOT(s)].state, __ATOMIC_RELAXED) == BATCH_DONE)
+			n++;
+	return n;
+}
+
+double Pipeline::capture_stall(void) const {
+	return __atomic_load_n(&stall_ns, __ATOMIC_RELAXED) / 1e9;
+}
+
+double Pipeline::output_wait(void) const {
+	return __atomic_load_n(&wait_ns, __ATOMIC_RELAXED) / 1e9;
+}
+
+unsigned long Pipeline::batches(void) const {
+	return __atomic_load_n(&out_seq, __ATOMIC_RELAXED);
+}
+
+void Pipeline::report(FILE *fp) const {
+	fprintf(fp, "pipeline: %lu batches on %d workers; capture stalled %.3f s,"
+		" output waited %.3f s\n", batches(), nworkers, capture_stall(),
+		output_wait());
+	for (int i=0; i<nworkers; i++)
+		fprintf(fp, "  worker %d: %lu batches, busy %.3f s\n", i,
+			pool[i].batches, pool[i].busy_ns / 1e9);
+}
@@ -0,0 +1,127 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "format.h"
+
+/* Decodes and formats packets on several threads without changing the
+ * order they come out in.  The capture thread copies frames into a
+ * batch, numbers it, and hands it to the worker with the shortest queue;
+ * each worker has its own single-producer single-consumer ring, so no
+ * queue needs a lock.  Workers format a batch into its own memory
+ * Formatter and mark it done.  Batches live in a ring of slots indexed
+ * by sequence number, which is also the reorder buffer: an output thread
+ * waits for the next batch in sequence to be done, writes it, and frees
+ * its slot for the capture thread to fill again.
+ *
+ * Waiting is spinning, then yielding, then short sleeps, so that an idle
+ * pipeline costs little CPU but a busy one never makes a system call to
+ * hand off work.  How long the capture thread stalls for a free slot,
+ * how long output waits on a late batch, and how busy each worker is
+ * are all counted. */
+
+#define PIPELINE_WORKERS 64
+#define PIPELINE_SLOTS 128  /* batches in flight; a power of two */
+#define PIPELINE_BATCH 64   /* frames per batch */
+#define PIPELINE_ARENA (256 * 1024)  /* frame bytes per batch */
+
+/* one frame, as the workers see it */
+struct PipelineItem {
+	long long ts;
+	const unsigned char *frame;
+	int len;
+	int source;  /* for the caller: which interface, say */
+	int note;    /* for the caller */
+	void *ptr;   /* for the caller: work done already, e.g. a decoded packet */
+};
+
+/* formats one frame into f; runs on a worker thread */
+typedef void (*PipelineFn)(Formatter &f, const PipelineItem &item, void *arg);
+
+class Pipeline {
+public:
+	/* output goes to fd, in the given Formatter mode */
+	Pipeline(int workers, int mode, int fd, PipelineFn fn, void *arg);
+	~Pipeline(void);
+	bool ok(void) const { return running; }
+	/* finish every frame added, then stop the threads */
+	void stop(void);
+
+	/* frames longer than PIPELINE_ARENA are cut short */
+	void add(long long ts, const unsigned char *frame, int len, int source,
+		int note, void *ptr);
+	/* send on a partly filled batch, as when capture goes quiet */
+	void flush(void);
+	void report(FILE *fp) const;
+
+	struct Worker {
+		Pipeline *pipe;
+		pthread_t thread;
+		int ring[PIPELINE_SLOTS];  /* slot numbers */
+		unsigned long head, tail;  /* the worker takes from head */
+		unsigned long batches;
+		unsigned long long busy_ns;
+		char label[24];  /* worker="N", for metrics */
+	} __attribute__((aligned(64)));
+
+	int workers(void) const { return nworkers; }
+	Worker *worker(int i) { return &pool[i]; }
+	/* batches queued at a worker but not started */
+	int queue_depth(int i) const;
+	/* batches done but waiting behind an earlier one */
+	int reorder_depth(void) const;
+	double capture_stall(void) const;
+	double output_wait(void) const;
+	unsigned long batches(void) const;
+
+private:
+	struct Batch {
+		int state;
+		int count, used;
+		PipelineItem items[PIPELINE_BATCH];
+		unsigned char *arena;
+		Formatter *out;
+	};
+	static void *work_thread(void *arg);
+	static void *output_thread(void *arg);
+	void dispatch(void);
+	Batch *filling(void);
+
+	int nworkers;
+	Worker *pool;
+	Batch slots[PIPELINE_SLOTS];
+	PipelineFn fn;
+	void *arg;
+	int fd;
+
+	unsigned long next_seq;  /* the batch the capture thread fills */
+	unsigned long out_seq;   /* the batch output waits for */
+	unsigned long long stall_ns, wait_ns;
+	pthread_t writer;
+	bool running, stopping;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include "blockfile.h"
+#include "buffer.h"
+#include "capindex.h"
+#include "format.h"
+#include "ippacket.h"
+#include "pcap.h"
+#include "resolve.h"
+
+/* Finds the packets in a pcap file that match a time range, addresses
+ * and ports, reading only the blocks its sidecar index points at. */
+
+struct Search {
+	PcapFile *pf;
+	IndexQuery q;
+	Formatter *out;
+	PcapWriter *writer;
+	BlockWriter *compressed;
+	unsigned long matches, records;
+	long long bytes_read;
+};
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] <pcap file>\n"
+		"       %s --build [-x FILE] <pcap file>\n"
+		"  -a, --addr=ADDR    packets to or from ADDR (at most twice)\n"
+		"  -p, --port=PORT    packets to or from PORT (at most twice)\n"
+		"  -f, --from=TIME    packets at or after TIME (seconds since the epoch)\n"
+		"  -t, --to=TIME      packets at or before TIME\n"
+		"  -x, --index=FILE   index to use (default <pcap file>.idx)\n"
+		"  -w, --write=FILE   write matching packets to a pcap file, or to a\n"
+		"                     compressed capture if FILE ends in .pkz\n"
+		"  -o, --output=FMT   print matches as text, json or csv (default text)\n"
+		"  -q, --quiet        only count the matches\n"
+		"  -b, --build        index an existing pcap file\n", argv0, argv0);
+	exit(1);
+}
+
+static void build(PcapFile *pf, const char *index_file) {
+	IndexWriter idx(index_file);
+	PcapRecord rec;
+	if (!idx.ok()) exit(1);
+	while (pf->next(&rec))
+		if (idx.add(rec, pf->tell() - 16 - rec.caplen, pf->linktype))
+			idx.close_block();
+	idx.close_block();
+	fprintf(stderr, "%lu blocks indexed\n", idx.blocks);
+}
+
+/* scan records from 'offset' up to 'end' (or the end of the file) */
+static void scan(Search *s, size_t offset, size_t end) {
+	PcapRecord rec;
+	if (!s->pf->seek(offset)) return;
+	while (s->pf->tell() < end && s->pf->next(&rec)) {
+		int len;
+		FlowKey k;
+		const unsigned char *ip = frame_ip(rec.data, rec.caplen, s->pf->linktype, &len);
+		bool have_key = ip && ip_flow(ip, len, &k);
+		s->records++;
+		s->bytes_read += 16 + rec.caplen;
+		if (!query_match(s->q, rec.ts, have_key ? &k : NULL)) continue;
+		s->matches++;
+		if (s->writer) s->writer->write(rec.ts, rec.data, rec.caplen, rec.len);
+		if (s->compressed) s->compressed->write(rec.ts, rec.data, rec.caplen, rec.len);
+		if (s->out && have_key) {
+			Buffer b(ip, len);
+			IPPacket p(b);
+			p.format(*s->out);
+			s->out->end_record();
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "addr", required_argument, NULL, 'a' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "from", required_argument, NULL, 'f' },
+		{ "to", required_argument, NULL, 't' },
+		{ "index", required_argument, NULL, 'x' },
+		{ "write", required_argument, NULL, 'w' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "build", no_argument, NULL, 'b' },
+		{ NULL, 0, NULL, 0 }
+	};
+	Search s;
+	const char *index_file = NULL, *write_file = NULL;
+	int mode = FORMAT_TEXT, c;
+	bool quiet = false, build_index = false;
+
+	memset(&s, 0, sizeof(s));
+	s.q.from = 0;
+	s.q.to = 0x7fffffffffffffffLL;
+	while ((c = getopt_long(argc, argv, "a:p:f:t:x:w:o:qb", long_options, NULL)) != -1) {
+		switch (c) {
+			case 'a':
+				if (s.q.naddrs == 2 || !inet_aton(optarg, &s.q.addrs[s.q.naddrs]))
+					usage(argv[0]);
+				s.q.naddrs++;
+				break;
+			case 'p':
+				if (s.q.nports == 2) usage(argv[0]);
+				s.q.ports[s.q.nports++] = atoi(optarg);
+				break;
+			case 'f':
+				s.q.from = (long long)(atof(optarg) * 1e9);
+				break;
+			case 't':
+				s.q.to = (long long)(atof(optarg) * 1e9);
+				break;
+			case 'x':
+				index_file = optarg;
+				break;
+			case 'w':
+				write_file = optarg;
+				break;
+			case 'o':
+				if ((mode = parse_format(optarg)) < 0) usage(argv[0]);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'b':
+				build_index = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1) usage(argv[0]);
+	resolve_init(false);
+
+	PcapFile pf(argv[optind]);
+	if (!pf.ok()) exit(1);
+	s.pf = &pf;
+	char *default_index = g_strdup_printf("%s.idx", argv[optind]);
+	if (!index_file) index_file = default_index;
+	if (build_index) {
+		build(&pf, index_file);
+		return 0;
+	}
+	if (write_file) {
+		int n = strlen(write_file);
+		if (n > 4 && !strcmp(write_file + n - 4, ".pkz")) {
+			s.compressed = new BlockWriter(write_file, pf.linktype, pf.snaplen);
+			if (!s.compressed->ok()) exit(1);
+		}
+		else {
+			s.writer = new PcapWriter(write_file, pf.linktype, pf.snaplen);
+			if (!s.writer->ok()) exit(1);
+		}
+	}
+	Formatter out(STDOUT_FILENO, mode);
+	if (!quiet) s.out = &out;
+
+	IndexReader idx(index_file);
+	g_free(default_index);
+	int selected = 0;
+	size_t indexed_end = 24;
+	if (idx.ok()) {
+		for (int i=0; i<idx.count(); i++) {
+			IndexBlock b;
+			idx.get(i, &b);
+			if (idx.may_match(b, s.q)) {
+				scan(&s, b.offset, b.offset + b.length);
+				selected++;
+			}
+			indexed_end = b.offset + b.length;
+		}
+	}
+	else
+		fprintf(stderr, "%s: no index, scanning the whole file\n", argv[0]);
+	/* records past the last indexed block: the capture may still be running */
+	scan(&s, indexed_end, (size_t)-1);
+	out.flush();
+	delete s.writer;
+	delete s.compressed;
+
+	size_t total = pf.tell() > 24 ? pf.tell() : 24;
+	fprintf(stderr, "%lu matches; read %d of %d blocks, %lld of %ld bytes (%.2f%%)\n",
+		s.matches, selected, idx.count(), s.bytes_read, (long)total,
+		total > 24 ? 100.0 * s.bytes_read / (total - 24) : 0.0);
+	return 0;
+}
@@ -0,0 +1,439 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "blockfile.h"
+#include "buffer.h"
+#include "capindex.h"
+#include "filter.h"
+#include "ippacket.h"
+#include "pacer.h"
+#include "pcap.h"
+#include "resolve.h"
+
+/* Aggregates over many pcap files at once.  The files are cut into
+ * tasks of about --split bytes, at index block boundaries where there is
+ * an index and by resynchronizing on record headers where there isn't;
+ * compressed captures (blockfile.h) are cut at block boundaries, and
+ * each worker decompresses its own blocks.
+ * Tasks are dealt round-robin into per-worker deques; a worker takes from
+ * the back of its own and, once that is empty, steals from the front of
+ * the others'.  Every partial result is a sum, so merging the workers'
+ * tables gives the same totals however the tasks fell, and the groups
+ * are sorted before printing. */
+
+struct Task {
+	int file;
+	size_t start, end;  /* byte offsets, or block numbers if compressed */
+	bool exact;  /* start is a known record boundary */
+	bool exact_end;  /* and so is end; otherwise the next task sync()s there */
+	bool compressed;
+};
+
+struct Group {
+	unsigned long long key;
+	unsigned long packets;
+	unsigned long long bytes;
+	bool used;
+};
+
+struct Worker {
+	pthread_t thread;
+	int id;
+	pthread_mutex_t lock;
+	int *tasks, head, tail;  /* this worker's deque */
+	Group *groups;
+	int ngroups, group_slots;
+	unsigned long scanned, matched, steals;
+	unsigned long long bytes;
+	unsigned char *raw;  /* a decompressed block */
+};
+
+static char **files;
+static int nfiles;
+static Task *tasks;
+static int ntasks;
+static Worker *workers;
+static int nworkers;
+static Filter filter;
+static int group_fields[2], ngroup_fields;
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] <capture file or directory> ...\n"
+		"  -f, --filter=EXPR   count only packets matching EXPR (see filter.h)\n"
+		"  -g, --group=F[,F]   group by one or two fields: proto, src, dst,\n"
+		"                      sport, dport, len, ttl, flags, icmptype,\n"
+		"                      icmpcode\n"
+		"  -n, --top=N         print the N biggest groups (default 20, 0 for all)\n"
+		"  -w, --workers=N     threads (default: one per CPU)\n"
+		"  -s, --split=MB      task size in megabytes (default 64)\n", argv0);
+	exit(1);
+}
+
+static void add_file(const char *name) {
+	files = g_renew(char*, files, nfiles+1);
+	files[nfiles++] = g_strdup(name);
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+/* a directory contributes its *.pcap and *.pkz files, in name order */
+static void add_path(const char *path) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		add_file(path);
+		return;
+	}
+	DIR *dir = opendir(path);
+	struct dirent *de;
+	int first = nfiles;
+	if (!dir) {
+		perror(path);
+		exit(1);
+	}
+	while ((de = readdir(dir))) {
+		int len = strlen(de->d_name);
+		if ((len > 5 && !strcmp(de->d_name + len - 5, ".pcap"))
+				|| (len > 4 && !strcmp(de->d_name + len - 4, ".pkz"))) {
+			char *name = g_strdup_printf("%s/%s", path, de->d_name);
+			add_file(name);
+			g_free(name);
+		}
+	}
+	closedir(dir);
+	qsort(files + first, nfiles - first, sizeof(char*), compare_names);
+}
+
+static void add_task(int file, size_t start, size_t end, bool exact,
+		bool exact_end, bool compressed = false) {
+	tasks = g_renew(Task, tasks, ntasks+1);
+	tasks[ntasks].file = file;
+	tasks[ntasks].start = start;
+	tasks[ntasks].end = end;
+	tasks[ntasks].exact = exact;
+	tasks[ntasks].exact_end = exact_end;
+	tasks[ntasks].compressed = compressed;
+	ntasks++;
+}
+
+static void split_file(int file, size_t split) {
+	struct stat st;
+	if (is_block_file(files[file])) {
+		BlockReader br(files[file]);
+		size_t raw = 0;
+		int first = 0;
+		for (int i=0; i<br.count(); i++) {
+			raw += br.block(i).rlen;
+			if (raw >= split || i == br.count() - 1) {
+				add_task(file, first, i + 1, true, true, true);
+				first = i + 1;
+				raw = 0;
+			}
+		}
+		return;
+	}
+	if (stat(files[file], &st) < 0 || st.st_size <= 24) return;
+	size_t size = st.st_size, start = 24;
+
+	char *name = g_strdup_printf("%s.idx", files[file]);
+	IndexReader idx(name);
+	g_free(name);
+	if (idx.ok()) {
+		for (int i=0; i<idx.count(); i++) {
+			IndexBlock b;
+			idx.get(i, &b);
+			size_t end = b.offset + b.length;
+			if (end - start >= split || i == idx.count() - 1) {
+				add_task(file, start, end, true, true);
+				start = end;
+			}
+		}
+	}
+	/* what the index doesn't cover */
+	bool exact = true;
+	while (start < size) {
+		size_t end = start + split < size ? start + split : size;
+		add_task(file, start, end, exact, end == size);
+		start = end;
+		exact = false;
+	}
+}
+
+static void add_group(Worker *w, unsigned long long key,
+		unsigned long packets, unsigned long long bytes) {
+	if (2 * (w->ngroups + 1) > w->group_slots) {
+		Group *old = w->groups;
+		int old_slots = w->group_slots;
+		w->group_slots = old_slots ? 2 * old_slots : 1024;
+		w->groups = g_new0(Group, w->group_slots);
+		w->ngroups = 0;
+		for (int i=0; i<old_slots; i++)
+			if (old[i].used) {
+				Group *g = &old[i];
+				unsigned int h = (g->key * 0x9E3779B97F4A7C15ULL) >> 32;
+				int j = h & (w->group_slots - 1);
+				while (w->groups[j].used) j = (j + 1) & (w->group_slots - 1);
+				w->groups[j] = *g;
+				w->ngroups++;
+			}
+		g_free(old);
+	}
+	unsigned int h = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+	int j = h & (w->group_slots - 1);
+	while (w->groups[j].used && w->groups[j].key != key)
+		j = (j + 1) & (w->group_slots - 1);
+	Group *g = &w->groups[j];
+	if (!g->used) {
+		g->used = true;
+		g->key = key;
+		w->ngroups++;
+	}
+	g->packets += packets;
+	g->bytes += bytes;
+}
+
+static void process(Worker *w, const PcapRecord &rec, int linktype) {
+	unsigned int fields[NFIELDS];
+	int len;
+	const unsigned char *ip = frame_ip(rec.data, rec.caplen, linktype, &len);
+	w->scanned++;
+	if (!ip) return;
+	Buffer b(ip, len);
+	IPPacket p(b);
+	packet_fields(p, fields);
+	if (!filter.match(fields)) return;
+	w->matched++;
+	w->bytes += rec.len;
+	unsigned long long key = 0;
+	for (int i=0; i<ngroup_fields; i++)
+		key = (key << 32) | fields[group_fields[i]];
+	add_group(w, key, 1, rec.len);
+}
+
+static void run_task(Worker *w, const Task *t) {
+	PcapRecord rec;
+
+	if (t->compressed) {
+		BlockReader br(files[t->file]);
+		if (!w->raw) w->raw = g_new(unsigned char, BLOCK_RAW_MAX);
+		for (size_t i=t->start; i<t->end; i++) {
+			int pos = 0;
+			if (!br.load(i, w->raw)) continue;
+			while (block_record(w->raw, br.block(i).rlen, &pos, &rec))
+				process(w, rec, br.linktype);
+		}
+		return;
+	}
+
+	PcapFile pf(files[t->file]);
+	if (!pf.ok()) return;
+	/* without an index, stop where the next task will start: found by the
+	 * same sync(), so the two always agree on the record boundary */
+	size_t stop = t->end;
+	if (!t->exact_end) {
+		pf.sync(t->end);
+		stop = pf.tell();
+	}
+	if (t->exact ? !pf.seek(t->start) : !pf.sync(t->start)) return;
+	while (pf.tell() < stop && pf.next(&rec))
+		process(w, rec, pf.linktype);
+}
+
+static bool take_task(Worker *w, int *task) {
+	bool found = false;
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) {
+		*task = w->tasks[--w->tail];
+		found = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	for (int i=1; !found && i<nworkers; i++) {
+		Worker *victim = &workers[(w->id + i) % nworkers];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->head < victim->tail) {
+			*task = victim->tasks[victim->head++];
+			found = true;
+			w->steals++;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return found;
+}
+
+static void *run_worker(void *arg) {
+	Worker *w = (Worker*)arg;
+	int task;
+	while (take_task(w, &task))
+		run_task(w, &tasks[task]);
+	return NULL;
+}
+
+static int compare_groups(const void *a, const void *b) {
+	const Group *x = (const Group*)a, *y = (const Group*)b;
+	if (x->packets != y->packets) return x->packets > y->packets ? -1 : 1;
+	if (x->key != y->key) return x->key < y->key ? -1 : 1;
+	return 0;
+}
+
+static void print_value(int field, unsigned int v) {
+	if (field == FIELD_SRC || field == FIELD_DST) {
+		struct in_addr a;
+		a.s_addr = htonl(v);
+		printf("%-16s", inet_ntoa(a));
+	}
+	else if (field == FIELD_PROTOCOL && protocol_name(v))
+		printf("%-16s", protocol_name(v));
+	else
+		printf("%-16u", v);
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{ "filter", required_argument, NULL, 'f' },
+		{ "group", required_argument, NULL, 'g' },
+		{ "top", required_argument, NULL, 'n' },
+		{ "workers", required_argument, NULL, 'w' },
+		{ "split", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int c, top = 20;
+	size_t split = 64 << 20;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt_long(argc, argv, "f:g:n:w:s:", long_options, NULL)) != -1) {
+		switch (c) {
+			case 'f':
+				if (!filter.compile(optarg)) exit(1);
+				break;
+			case 'g': {
+				char *scratch = g_strdup(optarg);
+				for (char *p = strtok(scratch, ","); p; p = strtok(NULL, ",")) {
+					if (ngroup_fields == 2 || (group_fields[ngroup_fields] =
+							field_number(p)) < 0)
+						usage(argv[0]);
+					ngroup_fields++;
+				}
+				g_free(scratch);
+				break;
+			}
+			case 'n':
+				top = atoi(optarg);
+				break;
+			case 'w':
+				nworkers = atoi(optarg);
+				if (nworkers < 1) usage(argv[0]);
+				break;
+			case 's':
+				split = (size_t)(atof(optarg) * (1 << 20));
+				if (split < 4096) usage(argv[0]);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind == argc) usage(argv[0]);
+	if (nworkers < 1) nworkers = 1;
+	resolve_init(false);
+
+	for (int i=optind; i<argc; i++)
+		add_path(argv[i]);
+	for (int i=0; i<nfiles; i++)
+		split_file(i, split);
+
+	workers = g_new0(Worker, nworkers);
+	for (int i=0; i<nworkers; i++) {
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].tasks = g_new(int, ntasks / nworkers + 1);
+	}
+	for (int i=0; i<ntasks; i++) {
+		Worker *w = &workers[i % nworkers];
+		w->tasks[w->tail++] = i;
+	}
+
+	nsec_t start = monotonic_ns();
+	for (int i=0; i<nworkers; i++)
+		if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (int i=0; i<nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+	double elapsed = (monotonic_ns() - start) / 1e9;
+
+	/* merge, in worker order, into worker 0's table */
+	Worker *total = &workers[0];
+	unsigned long steals = total->steals;
+	for (int i=1; i<nworkers; i++) {
+		Worker *w = &workers[i];
+		for (int j=0; j<w->group_slots; j++)
+			if (w->groups[j].used)
+				add_group(total, w->groups[j].key, w->groups[j].packets,
+					w->groups[j].bytes);
+		total->scanned += w->scanned;
+		total->matched += w->matched;
+		total->bytes += w->bytes;
+		steals += w->steals;
+	}
+
+	Group *sorted = g_new(Group, total->ngroups + 1);
+	int n = 0;
+	for (int j=0; j<total->group_slots; j++)
+		if (total->groups[j].used) sorted[n++] = total->groups[j];
+	qsort(sorted, n, sizeof(Group), compare_groups);
+
+	for (int i=0; i<ngroup_fields; i++)
+		printf("%-16s", field_name(group_fields[i]));
+	printf("%12s %16s\n", "packets", "bytes");
+	for (int i=0; i<n && (top == 0 || i < top || ngroup_fields == 0); i++) {
+		for (int f=0; f<ngroup_fields; f++) {
+			int shift = 32 * (ngroup_fields - 1 - f);
+			print_value(group_fields[f], (unsigned int)(sorted[i].key >> shift));
+		}
+		printf("%12lu %16llu\n", sorted[i].packets, sorted[i].bytes);
+	}
+	if (n == 0 && ngroup_fields == 0) printf("%12d %16d\n", 0, 0);
+	if (top && n > top && ngroup_fields) printf("(%d more groups)\n", n - top);
+
+	fprintf(stderr, "%lu packets in %d files, %lu matched, in %.2f s "
+		"(%.2f Mpps); %d tasks, %d workers, %lu steals\n",
+		total->scanned, nfiles, total->matched, elapsed,
+		elapsed > 0 ? total->scanned / elapsed / 1e6 : 0.0, ntasks,
+		nworkers, steals);
+	return 0;
+}
@@ -27,6 +27,7 @@
 #include <glade/glade.h>
 #include "icmppacket.h"
 #include "ippacket.h"
+#include "resolve.h"
 #include "tcppacket.h"
 #include "udppacket.h"
 
@@ -194,6 +195,7 @@ void protocol_changed(GtkEditable *editable) {
 int main(int argc, char **argv) {
   gtk_init(&argc, &argv);
   glade_init();
+  resolve_init(false);
   xml = glade_xml_new("pktgui.glade", NULL, NULL);
   glade_xml_signal_autoconnect(xml);
   gtk_main();
@@ -0,0 +1,241 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include "recorder.h"
+
+#define ENTRY_SIZE ((int)sizeof(Entry))
+#define ROUND8(n) (((n) + 7) & ~(size_t)7)
+
+FlightRecorder::FlightRecorder(int seconds, int megabytes, const char *prefix,
+		bool background) {
+	size = ROUND8((size_t)megabytes << 20);
+	ring = g_new(unsigned char, size);
+	/* fault every page in now, not while capturing */
+	memset(ring, 0, size);
+	head = tail = 0;
+	window = seconds * 1000000000LL;
+	this->prefix = g_strdup(prefix);
+	frames = bytes = 0;
+	dumps = evicted = refused = 0;
+	spare = NULL;
+	writing = closing = false;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	if (!background) return;
+	spare = g_new(unsigned char, size);
+	memset(spare, 0, size);
+	if (pthread_create(&writer, NULL, write_thread, this)) {
+		perror("pthread_create");
+		g_free(spare);
+		spare = NULL;
+	}
+}
+
+FlightRecorder::~FlightRecorder(void) {
+	if (spare) {
+		/* a dump under way is finished first */
+		pthread_mutex_lock(&lock);
+		closing = true;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+		pthread_join(writer, NULL);
+		g_free(spare);
+	}
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&wake);
+	g_free(ring);
+	g_free(prefix);
+}
+
+FlightRecorder *FlightRecorder::parse(const char *spec) {
+	char *end;
+	long secs = strtol(spec, &end, 10), mb = RECORDER_MB;
+	const char *prefix = "sniff";
+	if (end == spec || secs < 1) return NULL;
+	if (*end == ':') {
+		const char *p = end + 1;
+		mb = strtol(p, &end, 10);
+		if (end == p || mb < 1 || mb > 65536) return NULL;
+		if (*end == ':') {
+			prefix = end + 1;
+			if (!*prefix) return NULL;
+			end += strlen(end);
+		}
+	}
+	if (*end) return NULL;
+	return new FlightRecorder(secs, mb, prefix);
+}
+
+/* the oldest frame's header; skips a wrap marker, or a gap too small for
+ * one, at the end of the buffer */
+FlightRecorder::Entry *FlightRecorder::oldest(void) {
+	if (size - tail < (size_t)ENTRY_SIZE || ((Entry *)(ring + tail))->caplen < 0)
+		tail = 0;
+	return (Entry *)(ring + tail);
+}
+
+void FlightRecorder::evict(void) {
+	Entry *e = oldest();
+	tail += ENTRY_SIZE + ROUND8(e->caplen);
+	bytes -= e->caplen;
+	if (--frames == 0) head = tail = 0;
+	evicted++;
+}
+
+void FlightRecorder::add(long long ts, const unsigned char *frame, int caplen,
+		int len) {
+	if (caplen > RECORDER_MAX_FRAME) caplen = RECORDER_MAX_FRAME;
+	size_t need = ENTRY_SIZE + ROUND8(caplen);
+	if (need > size / 2) return;  /* a toy buffer */
+	while (frames && oldest()->ts < ts - window)
+		evict();
+
+	/* make room at head, wrapping to the start of the buffer if the end
+	 * is too short */
+	for (;;) {
+		if (frames == 0) break;
+		if (head > tail) {
+			if (size - head >= need) break;
+			if (tail >= need) {
+				if (size - head >= (size_t)ENTRY_SIZE)
+					((Entry *)(ring + head))->caplen = -1;
+				head = 0;
+				continue;
+			}
+		}
+		else if (tail - head >= need)
+			break;
+		evict();
+	}
+
+	Entry *e = (Entry *)(ring + head);
+	e->ts = ts;
+	e->caplen = caplen;
+	e->len = len;
+	memcpy(ring + head + ENTRY_SIZE, frame, caplen);
+	head += need;
+	frames++;
+	bytes += caplen;
+}
+
+/* write n frames from buf, starting with the one at from */
+unsigned long FlightRecorder::write_frames(const unsigned char *buf,
+		size_t from, unsigned long n, PcapWriter *out) const {
+	size_t pos = from;
+	for (unsigned long i=0; i<n; i++) {
+		if (size - pos < (size_t)ENTRY_SIZE || ((const Entry *)(buf + pos))->caplen < 0)
+			pos = 0;
+		const Entry *e = (const Entry *)(buf + pos);
+		out->write(e->ts, buf + pos + ENTRY_SIZE, e->caplen, e->len);
+		pos += ENTRY_SIZE + ROUND8(e->caplen);
+	}
+	return n;
+}
+
+unsigned long FlightRecorder::drain(PcapWriter *out) {
+	unsigned long n = write_frames(ring, tail, frames, out);
+	head = tail = 0;
+	frames = bytes = 0;
+	return n;
+}
+
+char *FlightRecorder::file_name(const char *prefix, unsigned long n) {
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+	return g_strdup_printf("%s-%s-%lu.pcap", prefix, stamp, n);
+}
+
+bool FlightRecorder::write_file(const unsigned char *buf, size_t from,
+		unsigned long n, size_t held, unsigned long number, const char *why) {
+	char *name = file_name(prefix, number);
+	PcapWriter out(name, LINK_ETHERNET, RECORDER_MAX_FRAME);
+	if (!out.ok()) {
+		g_free(name);
+		return false;
+	}
+	write_frames(buf, from, n, &out);
+	fprintf(stderr, "recorder: %s: wrote %lu frames, %lu bytes, to %s\n", why, n,
+		(unsigned long)held, name);
+	g_free(name);
+	return true;
+}
+
+bool FlightRecorder::dump(const char *why) {
+	if (!spare) {
+		if (!write_file(ring, tail, frames, bytes, dumps + 1, why)) return false;
+		dumps++;
+		head = tail = 0;
+		frames = bytes = 0;
+		return true;
+	}
+
+	pthread_mutex_lock(&lock);
+	bool busy = writing;
+	if (!busy) {
+		unsigned char *full = ring;
+		ring = spare;
+		spare = full;
+		spare_tail = tail;
+		spare_frames = frames;
+		spare_bytes = bytes;
+		this->why = why;
+		head = tail = 0;
+		frames = bytes = 0;
+		dumps++;
+		writing = true;
+		pthread_cond_signal(&wake);
+	}
+	pthread_mutex_unlock(&lock);
+	if (busy) {
+		refused++;
+		fprintf(stderr, "recorder: %s: still writing the last dump\n", why);
+	}
+	return !busy;
+}
+
+/* writes out each buffer dump() hands over, then gives it back */
+void *FlightRecorder::write_thread(void *arg) {
+	FlightRecorder *r = (FlightRecorder *)arg;
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		while (!r->writing && !r->closing)
+			pthread_cond_wait(&r->wake, &r->lock);
+		bool work = r->writing;
+		unsigned long number = r->dumps;
+		pthread_mutex_unlock(&r->lock);
+		if (!work) break;  /* closing, and nothing left */
+
+		r->write_file(r->spare, r->spare_tail, r->spare_frames, r->spare_bytes,
+			number, r->why);
+
+		pthread_mutex_lock(&r->lock);
+		r->writing = false;
+		pthread_mutex_unlock(&r->lock);
+	}
+	return NULL;
+}
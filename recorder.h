@@ -0,0 +1,103 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "pcap.h"
+
+/* A flight recorder: the last few seconds or megabytes of raw frames,
+ * kept in memory so that they can be written out after something goes
+ * wrong instead of archiving everything all the time.  Frames are copied
+ * into one circular buffer, allocated and touched up front, behind a
+ * 16-byte header each; the oldest go as room or the time window runs
+ * out.  Nothing is decoded or written until dump().  The buffer belongs
+ * to the capturing thread, so it needs no lock: dump() swaps it for a
+ * second buffer of the same size, also ready up front, and a writer
+ * thread writes the full one out, oldest first, to a new pcap file while
+ * capture carries on.  A dump asked for before the last one is written
+ * is refused.  A recorder made with background false has neither the
+ * second buffer nor the thread, and dump() writes in place. */
+
+#define RECORDER_MB 64
+#define RECORDER_MAX_FRAME 262144
+
+class FlightRecorder {
+public:
+	/* keeps at most seconds' worth of frames, in megabytes of memory (twice
+	 * that with background); dumps are named prefix-YYYYmmdd-HHMMSS-N.pcap */
+	FlightRecorder(int seconds, int megabytes, const char *prefix,
+		bool background = true);
+	~FlightRecorder(void);
+	/* "SECS", "SECS:MB" or "SECS:MB:PREFIX"; NULL if it makes no sense */
+	static FlightRecorder *parse(const char *spec);
+	/* ts in nanoseconds, in the order frames arrive */
+	void add(long long ts, const unsigned char *frame, int caplen, int len);
+	/* write what is held to out, oldest first, and forget it; returns the
+	 * number of frames written */
+	unsigned long drain(PcapWriter *out);
+	/* drain into a new file, saying why (a string constant) on stderr;
+	 * false if the last dump is still being written, or without
+	 * background, if the file can't be made */
+	bool dump(const char *why);
+	long long span(void) const { return window; }  /* ns */
+	/* prefix-YYYYmmdd-HHMMSS-N.pcap, for the caller to g_free() */
+	static char *file_name(const char *prefix, unsigned long n);
+
+	unsigned long frames;  /* held now */
+	size_t bytes;          /* of frame data held now */
+	unsigned long dumps, evicted;
+	unsigned long refused;  /* dumps asked for while one was being written */
+
+private:
+	struct Entry {
+		long long ts;
+		int caplen, len;  /* caplen < 0 marks the rest of the buffer unused */
+	};
+	Entry *oldest(void);
+	void evict(void);
+	unsigned long write_frames(const unsigned char *buf, size_t from,
+		unsigned long n, PcapWriter *out) const;
+	bool write_file(const unsigned char *buf, size_t from, unsigned long n,
+		size_t held, unsigned long number, const char *why);
+	static void *write_thread(void *arg);
+
+	unsigned char *ring;
+	size_t size, head, tail;  /* head: where the next frame goes */
+	long long window;  /* ns */
+	char *prefix;
+
+	/* the buffer being written, with the frames it held when swapped out */
+	unsigned char *spare;
+	size_t spare_tail, spare_bytes;
+	unsigned long spare_frames;
+	const char *why;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool writing, closing;
+};
+
+#endif
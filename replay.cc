@@ -0,0 +1,102 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "pacer.h"
+#include "pcap.h"
+#include "replay.h"
+#include "rewrite.h"
+#include "transmit.h"
+
+bool replay(const char *filename, Transmitter *tx, Pacer *pacer,
+		double speed, Rewriter *rw) {
+	PcapFile pf(filename);
+	PcapRecord rec;
+	unsigned long sent = 0, skipped = 0;
+	long long first_ts = 0, last_ts = 0;
+	nsec_t start = 0, end;
+	unsigned char scratch[65536];
+
+	if (!pf.ok()) return false;
+	while (pf.next(&rec)) {
+		int len;
+		const unsigned char *ip = frame_ip(rec.data, rec.caplen, pf.linktype, &len);
+		if (!ip) {
+			skipped++;
+			continue;
+		}
+		/* trust the IP length over the capture length: drop Ethernet padding,
+		 * and don't send a datagram the capture truncated, or one too short
+		 * to hold its own header */
+		int iplen = (ip[2] << 8) + ip[3], hlen = (ip[0] & 0x0F) * 4;
+		if (iplen > len || hlen < 20 || iplen < hlen) {
+			skipped++;
+			continue;
+		}
+
+		if (sent == 0) {
+			first_ts = rec.ts;
+			start = monotonic_ns();
+		}
+		last_ts = rec.ts;
+		if (speed > 0) {
+			nsec_t deadline = start + (nsec_t)((rec.ts - first_ts) / speed);
+			sleep_until(deadline);
+			pacer->note_error((monotonic_ns() - deadline) / 1e3);
+		}
+		else
+			pacer->wait(iplen);
+
+		if (rw && !rw->empty()) {
+			memcpy(scratch, ip, iplen);
+			rw->apply(scratch, iplen);
+			ip = scratch;
+		}
+		struct in_addr dst;
+		memcpy(&dst, ip+16, 4);
+		tx->send(ip, iplen, dst, 0);
+		sent++;
+	}
+	tx->flush();
+	end = monotonic_ns();
+
+	fprintf(stderr, "replay: %lu packets sent, %lu skipped (not IPv4, truncated"
+		" or malformed)\n", sent, skipped);
+	if (sent > 1) {
+		double span = (last_ts - first_ts) / 1e9, secs = (end - start) / 1e9;
+		fprintf(stderr, "replay: capture spans %.6f s, replayed in %.6f s (%.0f pps)\n",
+			span, secs, sent / secs);
+		if (speed > 0) {
+			double target = span / speed;
+			fprintf(stderr, "replay: target %.6f s, off by %+.3f ms; "
+				"per-packet lateness mean %.3f us, max %.3f us\n",
+				target, (secs - target) * 1e3,
+				pacer->error_sum() / MAX(1, pacer->error_count()), pacer->error_max());
+		}
+	}
+	if (rw && !rw->empty())
+		fprintf(stderr, "replay: %lu packets rewritten\n", rw->rewritten);
+	if (pacer->active()) pacer->report(stderr);
+	return true;
+}
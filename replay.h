@@ -0,0 +1,39 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+class Pacer;
+class Rewriter;
+class Transmitter;
+
+/* Retransmit the IPv4 datagrams in a pcap file.  With speed > 0 each
+ * packet is held until its capture offset divided by 'speed' has passed
+ * since the first one (1 replays at the original timing); with speed <= 0
+ * packets go as fast as 'pacer' lets them.  Deadlines are absolute, so
+ * timing errors don't accumulate over a long capture.  If 'rw' has rules,
+ * each datagram is copied out of the mapping and rewritten on the way. */
+bool replay(const char *filename, Transmitter *tx, Pacer *pacer,
+	double speed, Rewriter *rw);
+
+#endif
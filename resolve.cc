@@ -0,0 +1,217 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <glib.h>
+#include "resolve.h"
+
+#define HOST_CACHE_SIZE 4096  /* power of two */
+#define HOST_QUEUE_SIZE 256
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static bool want_reverse;
+
+static struct in_addr source;
+
+struct ProtoName {
+	char *name;
+	int number;
+};
+static char *proto_names[256];
+static ProtoName *proto_by_name;
+static int nproto_by_name;
+
+/* reverse DNS: a direct-mapped cache, and a ring of pending lookups for
+ * the resolver thread */
+enum { HOST_EMPTY, HOST_PENDING, HOST_DONE };
+struct HostEntry {
+	unsigned int addr;
+	int state;
+	char name[HOST_NAME_MAX_LEN];
+};
+static HostEntry *host_cache;
+static unsigned int host_queue[HOST_QUEUE_SIZE];
+static int queue_head, queue_tail;
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t host_wake = PTHREAD_COND_INITIALIZER;
+
+/* in case /etc/protocols is missing, as it is in some containers */
+static const struct {
+	int number;
+	const char *name;
+} builtin_protocols[] = {
+	{ 0, "ip" }, { 1, "icmp" }, { 2, "igmp" }, { 4, "ipencap" }, { 6, "tcp" },
+	{ 17, "udp" }, { 41, "ipv6" }, { 47, "gre" }, { 50, "esp" }, { 51, "ah" },
+	{ 58, "ipv6-icmp" }, { 89, "ospf" }, { 132, "sctp" }, { -1, NULL }
+};
+
+static void add_proto_name(const char *name, int number) {
+	if (number < 0 || number > 255) return;
+	if (!proto_names[number]) proto_names[number] = g_strdup(name);
+	for (int i=0; i<nproto_by_name; i++)
+		if (!strcasecmp(proto_by_name[i].name, name)) return;
+	proto_by_name = g_renew(ProtoName, proto_by_name, nproto_by_name+1);
+	proto_by_name[nproto_by_name].name = g_strdup(name);
+	proto_by_name[nproto_by_name].number = number;
+	nproto_by_name++;
+}
+
+static int compare_proto(const void *a, const void *b) {
+	return strcasecmp(((const ProtoName*)a)->name, ((const ProtoName*)b)->name);
+}
+
+static void *resolver_thread(void *arg);
+
+static void do_init(void) {
+	char buf[256];
+	struct hostent *hent;
+	struct protoent *pe;
+	int i;
+
+	gethostname(buf, sizeof(buf));
+	hent = gethostbyname(buf);
+	if (hent)
+		memcpy(&source, hent->h_addr_list[0], sizeof(source));
+	else {
+		g_warning("IP: could not get host name to set default src");
+		bzero(&source, sizeof(source));
+	}
+
+	setprotoent(1);
+	while ((pe = getprotoent()) != NULL) {
+		add_proto_name(pe->p_name, pe->p_proto);
+		for (i=0; pe->p_aliases[i]; i++)
+			add_proto_name(pe->p_aliases[i], pe->p_proto);
+	}
+	endprotoent();
+	for (i=0; builtin_protocols[i].name; i++)
+		add_proto_name(builtin_protocols[i].name, builtin_protocols[i].number);
+	qsort(proto_by_name, nproto_by_name, sizeof(ProtoName), compare_proto);
+
+	if (want_reverse) {
+		pthread_t thread;
+		host_cache = g_new0(HostEntry, HOST_CACHE_SIZE);
+		if (pthread_create(&thread, NULL, resolver_thread, NULL) == 0)
+			pthread_detach(thread);
+		else {
+			g_warning("could not start the resolver thread");
+			want_reverse = false;
+		}
+	}
+}
+
+void resolve_init(bool reverse_dns) {
+	want_reverse = reverse_dns;
+	pthread_once(&init_once, do_init);
+}
+
+static void ensure_init(void) {
+	pthread_once(&init_once, do_init);
+}
+
+struct in_addr default_source(void) {
+	ensure_init();
+	return source;
+}
+
+const char *protocol_name(int number) {
+	ensure_init();
+	return number >= 0 && number < 256 ? proto_names[number] : NULL;
+}
+
+int protocol_number(const char *name) {
+	ProtoName key, *found;
+	ensure_init();
+	key.name = (char*)name;
+	found = (ProtoName*)bsearch(&key, proto_by_name, nproto_by_name,
+		sizeof(ProtoName), compare_proto);
+	return found ? found->number : -1;
+}
+
+static unsigned int host_slot(unsigned int addr) {
+	return (addr * 2654435761u) >> 20 & (HOST_CACHE_SIZE - 1);
+}
+
+bool host_name(struct in_addr addr, char *buf, int size) {
+	ensure_init();
+	if (!want_reverse || !host_cache) return false;
+
+	bool found = false;
+	HostEntry *e = &host_cache[host_slot(addr.s_addr)];
+	pthread_mutex_lock(&host_lock);
+	if (e->state != HOST_EMPTY && e->addr == addr.s_addr) {
+		/* copied under the lock: the slot may be reused once it is let go */
+		if (e->state == HOST_DONE && e->name[0]) {
+			snprintf(buf, size, "%s", e->name);
+			found = true;
+		}
+	}
+	else if ((queue_tail + 1) % HOST_QUEUE_SIZE != queue_head) {
+		e->addr = addr.s_addr;
+		e->state = HOST_PENDING;
+		e->name[0] = '\0';
+		host_queue[queue_tail] = addr.s_addr;
+		queue_tail = (queue_tail + 1) % HOST_QUEUE_SIZE;
+		pthread_cond_signal(&host_wake);
+	}
+	pthread_mutex_unlock(&host_lock);
+	return found;
+}
+
+static void *resolver_thread(void *arg) {
+	for (;;) {
+		struct sockaddr_in sin;
+		char name[sizeof(((HostEntry*)0)->name)];
+
+		pthread_mutex_lock(&host_lock);
+		while (queue_head == queue_tail)
+			pthread_cond_wait(&host_wake, &host_lock);
+		unsigned int addr = host_queue[queue_head];
+		queue_head = (queue_head + 1) % HOST_QUEUE_SIZE;
+		pthread_mutex_unlock(&host_lock);
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = addr;
+		if (getnameinfo((struct sockaddr*)&sin, sizeof(sin), name, sizeof(name),
+				NULL, 0, NI_NAMEREQD) != 0)
+			name[0] = '\0';
+
+		/* the slot may have been taken by another address meanwhile */
+		HostEntry *e = &host_cache[host_slot(addr)];
+		pthread_mutex_lock(&host_lock);
+		if (e->addr == addr && e->state == HOST_PENDING) {
+			strcpy(e->name, name);
+			e->state = HOST_DONE;
+		}
+		pthread_mutex_unlock(&host_lock);
+	}
+	return NULL;
+}
@@ -0,0 +1,47 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <arpa/inet.h>
+
+/* Name lookups the packet code needs, answered from tables filled once
+ * by resolve_init() so no per-packet path waits on the resolver.  The
+ * lookups call resolve_init(false) themselves if nobody has yet. */
+void resolve_init(bool reverse_dns);
+
+/* the address of this host's name, for IPPacket's default source */
+struct in_addr default_source(void);
+
+/* /etc/protocols, both ways: NULL or -1 if unknown */
+const char *protocol_name(int number);
+int protocol_number(const char *name);
+
+/* With reverse_dns on, copies the cached name for an address into buf,
+ * if one has been looked up, and returns true; otherwise false.  A miss
+ * queues a lookup on a background thread and returns at once.  Safe to
+ * call from several threads. */
+#define HOST_NAME_MAX_LEN 64
+bool host_name(struct in_addr addr, char *buf, int size);
+
+#endif
@@ -0,0 +1,275 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include "ippacket.h"
+#include "packet.h"
+#include "rewrite.h"
+#include "token.h"
+
+Rewriter::Rewriter(void) {
+	rules = NULL;
+	nrules = 0;
+	src_table = dst_table = NULL;
+	sport = dport = 0;
+	ttl = tos = -1;
+	ports = false;
+	rewritten = 0;
+}
+
+Rewriter::~Rewriter(void) {
+	if (src_table) {
+		g_free(src_table->ext);
+		g_free(src_table);
+	}
+	if (dst_table) {
+		g_free(dst_table->ext);
+		g_free(dst_table);
+	}
+	g_free(rules);
+}
+
+static unsigned int prefix_mask(int bits) {
+	return bits ? 0xFFFFFFFFu << (32 - bits) : 0;
+}
+
+static bool parse_shift(const char *s, int *shift) {
+	char *end;
+	while (*s == ' ' || *s == '\t') s++;
+	long v = strtol(s, &end, 10);
+	if (end == s || *end) return false;
+	*shift = v;
+	return true;
+}
+
+bool Rewriter::add_rule(const char *rule) {
+	bool src = false, dst = false;
+	if (!strncasecmp(rule, "src ", 4)) src = true;
+	else if (!strncasecmp(rule, "dst ", 4)) dst = true;
+	else if (!strncasecmp(rule, "addr ", 5)) src = dst = true;
+	else if (!strncasecmp(rule, "sport ", 6)) {
+		ports = true;
+		return parse_shift(rule+6, &sport);
+	}
+	else if (!strncasecmp(rule, "dport ", 6)) {
+		ports = true;
+		return parse_shift(rule+6, &dport);
+	}
+	else if (!strncasecmp(rule, "port ", 5)) {
+		ports = true;
+		if (!parse_shift(rule+5, &sport)) return false;
+		dport = sport;
+		return true;
+	}
+	else if (!strncasecmp(rule, "ttl=", 4)) {
+		ttl = parse_number(rule+4) & 0xFF;
+		return true;
+	}
+	else if (!strncasecmp(rule, "tos=", 4)) {
+		tos = parse_number(rule+4) & 0xFF;
+		return true;
+	}
+	else
+		return false;
+
+	char from[32], to[32];
+	int from_bits = 32, to_bits = -1;
+	struct in_addr a, b;
+	const char *p = strchr(rule, ' ');
+	while (*p == ' ') p++;
+	if (sscanf(p, "%31[0-9.]/%d=%31[0-9.]/%d", from, &from_bits, to, &to_bits) < 3
+			&& sscanf(p, "%31[0-9.]=%31[0-9.]", from, to) != 2)
+		return false;
+	if (to_bits < 0) to_bits = from_bits;
+	if (from_bits < 0 || from_bits > 32 || to_bits > 32
+			|| !inet_aton(from, &a) || !inet_aton(to, &b))
+		return false;
+
+	rules = g_renew(Map, rules, nrules+1);
+	Map *m = &rules[nrules++];
+	m->from_mask = prefix_mask(from_bits);
+	m->from = ntohl(a.s_addr) & m->from_mask;
+	m->to_mask = prefix_mask(to_bits);
+	m->to = ntohl(b.s_addr) & m->to_mask;
+	m->bits = from_bits;
+	m->src = src;
+	m->dst = dst;
+	return true;
+}
+
+void Rewriter::compile_table(Table *t, bool src) {
+	int *order = g_new(int, nrules), n = 0, i, j;
+
+	/* the rules for this direction, shortest prefix first */
+	for (i=0; i<nrules; i++) {
+		if (src ? !rules[i].src : !rules[i].dst) continue;
+		for (j=n; j>0 && rules[order[j-1]].bits > rules[i].bits; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+		n++;
+	}
+
+	for (i=0; i<65536; i++) t->top[i] = -1;
+	t->ext = NULL;
+	t->next = 0;
+
+	/* /0-/16: fill every covered slot, longer prefixes overwriting */
+	for (i=0; i<n && rules[order[i]].bits <= 16; i++) {
+		const Map *m = &rules[order[i]];
+		unsigned int first = m->from >> 16, count = 1u << (16 - m->bits);
+		for (unsigned int s=first; s<first+count; s++)
+			t->top[s] = order[i];
+	}
+
+	/* /17-/32: per-slot lists, longest first, ending with the slot's
+	 * short-prefix rule as a fallback: [n, rule..., fallback] */
+	int first_long = i;
+	for (i=n-1; i>=first_long; i--) {
+		unsigned int slot = rules[order[i]].from >> 16;
+		if (t->top[slot] <= -2) continue;  /* built already */
+		int count = 0;
+		for (j=i; j>=first_long; j--)
+			if ((rules[order[j]].from >> 16) == slot) count++;
+		t->ext = g_renew(int, t->ext, t->next + count + 2);
+		int off = t->next;
+		t->ext[off] = count;
+		count = 0;
+		for (j=i; j>=first_long; j--)
+			if ((rules[order[j]].from >> 16) == slot)
+				t->ext[off + 1 + count++] = order[j];
+		t->ext[off + 1 + count] = t->top[slot];
+		t->top[slot] = -(off + 2);
+		t->next = off + count + 2;
+	}
+	g_free(order);
+}
+
+void Rewriter::compile(void) {
+	bool any_src = false, any_dst = false;
+	for (int i=0; i<nrules; i++) {
+		any_src |= rules[i].src;
+		any_dst |= rules[i].dst;
+	}
+	if (any_src) {
+		src_table = g_new(Table, 1);
+		compile_table(src_table, true);
+	}
+	if (any_dst) {
+		dst_table = g_new(Table, 1);
+		compile_table(dst_table, false);
+	}
+}
+
+int Rewriter::lookup(const Table *t, unsigned int addr) const {
+	int v = t->top[addr >> 16];
+	if (v >= -1) return v;
+	const int *e = t->ext + (-v - 2);
+	for (int i=1; i<=e[0]; i++) {
+		const Map *m = &rules[e[i]];
+		if ((addr & m->from_mask) == m->from) return e[i];
+	}
+	return e[e[0] + 1];
+}
+
+unsigned int Rewriter::rewrite_addr(const Table *t, unsigned int addr) const {
+	int r = lookup(t, addr);
+	if (r < 0) return addr;
+	return rules[r].to | (addr & ~rules[r].to_mask);
+}
+
+/* Store a 16-bit word and fix up the checksums that cover it. */
+static bool patch16(unsigned char *p, unsigned int v, unsigned int *sum1,
+		unsigned int *sum2) {
+	unsigned int old = (p[0] << 8) + p[1];
+	if (old == v) return false;
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+	if (sum1) *sum1 = adjust_checksum(*sum1, old, v);
+	if (sum2) *sum2 = adjust_checksum(*sum2, old, v);
+	return true;
+}
+
+static unsigned int get32(const unsigned char *p) {
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Rewrite an IPv4 datagram in place. */
+void Rewriter::apply(unsigned char *ip, int len) {
+	if (len < 20 || (ip[0] >> 4) != 4) return;
+	int hl = (ip[0] & 0x0F) * 4;
+	if (hl < 20 || hl > len) return;
+
+	unsigned int sum = (ip[10] << 8) + ip[11], l4sum = 0;
+	unsigned char *l4 = ip + hl;
+	int l4len = len - hl, cs = -1;
+	bool first_frag = ((ip[6] & 0x1F) << 8) + ip[7] == 0;
+	bool changed = false;
+
+	if (first_frag && ip[9] == IP_TCP && l4len >= 20) cs = 16;
+	else if (first_frag && ip[9] == IP_UDP && l4len >= 8) cs = 6;
+	if (cs >= 0) {
+		l4sum = (l4[cs] << 8) + l4[cs+1];
+		if (ip[9] == IP_UDP && l4sum == 0) cs = -1;  /* no UDP checksum */
+	}
+	unsigned int *l4p = cs >= 0 ? &l4sum : NULL;
+
+	if (src_table) {
+		unsigned int a = get32(ip+12), b = rewrite_addr(src_table, a);
+		if (a != b) {
+			patch16(ip+12, b >> 16, &sum, l4p);
+			patch16(ip+14, b & 0xFFFF, &sum, l4p);
+			changed = true;
+		}
+	}
+	if (dst_table) {
+		unsigned int a = get32(ip+16), b = rewrite_addr(dst_table, a);
+		if (a != b) {
+			patch16(ip+16, b >> 16, &sum, l4p);
+			patch16(ip+18, b & 0xFFFF, &sum, l4p);
+			changed = true;
+		}
+	}
+	if (ports && first_frag && (ip[9] == IP_TCP || ip[9] == IP_UDP)
+			&& l4len >= 4) {
+		changed |= patch16(l4, (((l4[0] << 8) + l4[1]) + sport) & 0xFFFF, l4p, NULL);
+		changed |= patch16(l4+2, (((l4[2] << 8) + l4[3]) + dport) & 0xFFFF, l4p, NULL);
+	}
+	if (ttl >= 0)
+		changed |= patch16(ip+8, (ttl << 8) + ip[9], &sum, NULL);
+	if (tos >= 0)
+		changed |= patch16(ip, (ip[0] << 8) + tos, &sum, NULL);
+
+	if (!changed) return;
+	ip[10] = sum >> 8;
+	ip[11] = sum & 0xFF;
+	if (cs >= 0) {
+		if (ip[9] == IP_UDP && l4sum == 0) l4sum = 0xFFFF;
+		l4[cs] = l4sum >> 8;
+		l4[cs+1] = l4sum & 0xFF;
+	}
+	rewritten++;
+}
@@ -0,0 +1,68 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef REWRITE_H
+#define REWRITE_H
+
+/* Header rewriting for replayed traffic.  Rules, one per add_rule():
+ *   src A.B.C.D/N=E.F.G.H/M   map source addresses in one net into another,
+ *   dst A.B.C.D/N=E.F.G.H/M   keeping the host bits below /M
+ *   addr A.B.C.D/N=E.F.G.H/M  both of the above
+ *   sport +K, dport +K, port +K   shift TCP/UDP ports (K may be negative)
+ *   ttl=N, tos=N              override those fields
+ * Address maps are compiled into a table indexed by the top 16 bits of the
+ * address, with short lists for the few /17-/32 rules; the longest
+ * matching prefix wins.  Checksums are fixed up incrementally. */
+class Rewriter {
+public:
+	Rewriter(void);
+	~Rewriter(void);
+	bool add_rule(const char *rule);
+	void compile(void);
+	bool empty(void) const { return nrules == 0 && !ports && ttl < 0 && tos < 0; }
+	void apply(unsigned char *ip, int len);
+
+	unsigned long rewritten;
+
+private:
+	struct Map {
+		unsigned int from, from_mask, to, to_mask;
+		int bits;
+		bool src, dst;
+	};
+	struct Table {
+		int top[65536];  /* >= 0: rule; -1: none; <= -2: ext list -(v+2) */
+		int *ext;
+		int next;
+	};
+	void compile_table(Table *t, bool src);
+	int lookup(const Table *t, unsigned int addr) const;
+	unsigned int rewrite_addr(const Table *t, unsigned int addr) const;
+
+	Map *rules;
+	int nrules;
+	Table *src_table, *dst_table;
+	int sport, dport, ttl, tos;
+	bool ports;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+#include "ether.h"
+#include "pcap.h"
+#include "sample.h"
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+Sampler::Sampler(void) {
+	mode = SAMPLE_NONE;
+	rate = 1;
+	max_rate = SAMPLE_AUTO_MAX;
+	seen = kept = 0;
+	counter = since_check = calm = 0;
+	last_fill = 0;
+}
+
+bool Sampler::parse(const char *spec) {
+	char *end;
+	if (!strncmp(spec, "auto", 4)) {
+		mode = SAMPLE_AUTO;
+		rate = 1;
+		if (spec[4] == '\0') return true;
+		if (spec[4] != ':') return false;
+		max_rate = strtol(spec+5, &end, 10);
+		return *end == '\0' && max_rate >= 1;
+	}
+	mode = SAMPLE_COUNT;
+	if (!strncmp(spec, "flow:", 5)) {
+		mode = SAMPLE_FLOW;
+		spec += 5;
+	}
+	rate = strtol(spec, &end, 10);
+	return *end == '\0' && end != spec && rate >= 1;
+}
+
+/* the same for both directions of a flow */
+static unsigned int flow_hash(const FlowKey &k) {
+	unsigned long long a = ((unsigned long long)ntohl(k.src.s_addr) << 16) | k.sport;
+	unsigned long long b = ((unsigned long long)ntohl(k.dst.s_addr) << 16) | k.dport;
+	if (a > b) {
+		unsigned long long t = a;
+		a = b;
+		b = t;
+	}
+	unsigned long long x = a * 0x9E3779B97F4A7C15ULL ^ b ^ k.protocol;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+bool Sampler::keep(const unsigned char *frame, int caplen) {
+	bool keep;
+	seen++;
+	if (mode == SAMPLE_NONE || rate == 1)
+		keep = true;
+	else {
+		EtherFrame ef;
+		FlowKey k;
+		if (mode != SAMPLE_COUNT
+				&& ether_classify(frame, caplen, &ef) == ETHER_IPV4
+				&& ip_flow(ef.payload, ef.length, &k))
+			keep = flow_hash(k) % rate == 0;
+		else {
+			/* count mode, or no flow to hash */
+			keep = counter == 0;
+			if (++counter >= (unsigned int)rate) counter = 0;
+		}
+	}
+	if (keep) kept++;
+	return keep;
+}
+
+bool Sampler::adapt(const int *fds, int n) {
+	if (mode != SAMPLE_AUTO || ++since_check < SAMPLE_CHECK) return false;
+	since_check = 0;
+	/* one rate covers every socket, so the one furthest behind sets it;
+	 * comparing one socket's fill with another's would only be noise */
+	double fill = -1;
+	for (int i=0; i<n; i++) {
+		double f = socket_backlog(fds[i]);
+		if (f > fill) fill = f;
+	}
+	/* only push harder while the backlog is still growing; once it is
+	 * draining, the current rate is enough */
+	bool growing = fill > last_fill;
+	last_fill = fill;
+	if (fill > 0.5 && growing && rate * 2 <= max_rate) {
+		rate *= 2;
+		calm = 0;
+		return true;
+	}
+	/* back off slowly, so the rate doesn't flap */
+	calm = fill >= 0 && fill < 0.05 ? calm + 1 : 0;
+	if (calm >= SAMPLE_CALM && rate > 1) {
+		rate /= 2;
+		calm = 0;
+		return true;
+	}
+	return false;
+}
+
+double socket_backlog(int fd) {
+	unsigned int mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0
+			|| mem[SK_MEMINFO_RCVBUF] == 0)
+		return -1;
+	return (double)mem[SK_MEMINFO_RMEM_ALLOC] / mem[SK_MEMINFO_RCVBUF];
+}
+
+long socket_drops(int fd) {
+	unsigned int mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0
+			|| len <= SK_MEMINFO_DROPS * sizeof(unsigned int))
+		return -1;
+	return mem[SK_MEMINFO_DROPS];
+}
@@ -0,0 +1,70 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+/* Chooses which captured frames to keep when there are too many to
+ * decode.  It looks only at raw headers, so it runs before any decoding.
+ *   count  keep every rate'th frame
+ *   flow   keep a frame if its flow hashes to 0 mod rate: all of a flow,
+ *          both directions, or none of it
+ *   auto   flow sampling, with a power-of-two rate that doubles while
+ *          the socket backlog is over half full and still growing, and
+ *          halves once it has stayed nearly empty for a while.  Flows
+ *          kept at a high rate are a subset of those kept at any lower
+ *          one, so a flow is only ever cut where the rate changes.
+ * Each kept frame stands for 'rate' frames; the caller should record the
+ * rate alongside what it keeps. */
+
+enum { SAMPLE_NONE, SAMPLE_COUNT, SAMPLE_FLOW, SAMPLE_AUTO };
+
+#define SAMPLE_AUTO_MAX 1024
+#define SAMPLE_CHECK 256  /* frames between backlog checks in auto */
+#define SAMPLE_CALM 16    /* quiet checks in a row before halving */
+
+class Sampler {
+public:
+	Sampler(void);
+	/* "N", "flow:N" or "auto[:MAX]"; false if it makes no sense */
+	bool parse(const char *spec);
+	bool enabled(void) const { return mode != SAMPLE_NONE; }
+	/* decide about one Ethernet frame */
+	bool keep(const unsigned char *frame, int caplen);
+	/* auto: adjust the rate to the fullest of n sockets' backlogs, every
+	 * SAMPLE_CHECK frames; true if the rate changed */
+	bool adapt(const int *fds, int n);
+
+	int mode, rate, max_rate;
+	unsigned long seen, kept;
+
+private:
+	unsigned int counter, since_check, calm;
+	double last_fill;
+};
+
+/* how full a socket's receive buffer is, 0 to 1; -1 if unknown */
+double socket_backlog(int fd);
+/* frames a socket has dropped for want of buffer space; -1 if unknown */
+long socket_drops(int fd);
+
+#endif
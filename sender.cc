@@ -20,55 +20,553 @@
  * 02111-1307, USA.
  */
 
+#include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 #include <netinet/ip.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <glib.h>
+#include "ippacket.h"
+#include "metrics.h"
+#include "pacer.h"
 #include "packet.h"
+#include "replay.h"
+#include "resolve.h"
+#include "rewrite.h"
+#include "token.h"
+#include "transmit.h"
 
-int fd;
+/* a prepared datagram, ready to go out as many times as asked */
+struct Frame {
+	Buffer b;
+	struct in_addr dst;
+	int port;
+};
 
-void send(FILE *fp) {
+/* a worker's private copy of a frame, packed into its slab */
+struct SlabFrame {
+	unsigned char *data;
+	int length;
+	struct in_addr dst;
+	int port;
+	int l4;  /* offset of the TCP/UDP header, or -1 */
+};
+
+/* How workers divide the job: by handing each a disjoint subset of the
+ * spec, by giving each a share of the rate, or by giving each a disjoint
+ * slice of the source port space. */
+enum { SPLIT_COUNT, SPLIT_RATE, SPLIT_FIELD };
+
+/* Each worker owns its transmitter (and so its socket or ring), its
+ * PRNG, its pacer and its frame slab; the parsed spec is shared
+ * read-only. */
+struct Worker {
+	int index;
+	pthread_t thread;
+	Transmitter *tx;
+	Pacer *pacer;
+	unsigned long count;
+	double duration;
+	unsigned int rng;
+	SlabFrame *frames;
+	int nframes;
+	unsigned char *slab;
+	unsigned int port_lo, port_span;
+	nsec_t start, end;
+};
+
+static bool quiet = false;
+static Frame **frames = NULL;
+static int nframes = 0;
+
+void load(SpecFile &sf) {
 	Packet *p;
 	
-	while ((p = parse(fp)) != NULL) {
-		struct sockaddr_in sin;
+	while ((p = parse(sf)) != NULL) {
 		p->prepare();
-		Buffer b = p->to_buffer();
-		printf("buffer = { ");
-		b.print();
-		printf(" }\n");
-		sin.sin_family = AF_INET;
-		sin.sin_port = p->get_port();
-		sin.sin_addr = p->get_dest();
-		if (sendto(fd, b.data, b.length, 0, (struct sockaddr*)&sin,
-				sizeof(sin)) == -1)
-			perror("sendto");
+		Frame *f = new Frame;
+		f->b = p->to_buffer();
+		f->dst = p->get_dest();
+		f->port = p->get_port();
+		if (!quiet) {
+			printf("buffer = { ");
+			f->b.print();
+			printf(" }\n");
+		}
+		frames = g_renew(Frame*, frames, nframes+1);
+		frames[nframes++] = f;
+		delete p;
 	}
 }
 
-int make_raw_socket() {
-	int fd;
-	if ((fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
-		perror("raw socket");
-		exit(1);
+/* Copy frames first, first+step, first+2*step, ... into one contiguous
+ * allocation owned by the worker. */
+static void build_slab(Worker *w, int first, int step) {
+	int i, n = 0, total = 0;
+	for (i=first; i<nframes; i+=step) {
+		total += frames[i]->b.length;
+		n++;
+	}
+	w->nframes = n;
+	w->frames = g_new(SlabFrame, n);
+	w->slab = g_new(unsigned char, total);
+	unsigned char *p = w->slab;
+	for (i=first, n=0; i<nframes; i+=step, n++) {
+		const Buffer &b = frames[i]->b;
+		SlabFrame *sf = &w->frames[n];
+		memcpy(p, b.data, b.length);
+		sf->data = p;
+		sf->length = b.length;
+		sf->dst = frames[i]->dst;
+		sf->port = frames[i]->port;
+		sf->l4 = -1;
+		if (b.length >= 20 && (b.data[0] >> 4) == 4) {
+			int hl = (b.data[0] & 0x0F) * 4;
+			if ((b.data[9] == IP_TCP && b.length >= hl + 20)
+					|| (b.data[9] == IP_UDP && b.length >= hl + 8))
+				sf->l4 = hl;
+		}
+		p += b.length;
 	}
-	return fd;
 }
 
-int main(int argc, char **argv) {
-	int i;
-	fd = make_raw_socket();
-	for (i=1; i<argc; i++) {
-		FILE *fp = fopen(argv[i], "r");
-		if (!fp)
-			perror(argv[i]);
-		else {
-			send(fp);
+static unsigned int xorshift(unsigned int *state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* Move the source port into this worker's slice, fixing the transport
+ * checksum incrementally. */
+static void partition_port(Worker *w, SlabFrame *f) {
+	unsigned char *l4 = f->data + f->l4;
+	unsigned int old = (l4[0] << 8) + l4[1];
+	unsigned int sport = w->port_lo + xorshift(&w->rng) % w->port_span;
+	int cs = f->data[9] == IP_TCP ? 16 : 6;
+	unsigned int sum = (l4[cs] << 8) + l4[cs+1];
+	l4[0] = sport >> 8;
+	l4[1] = sport & 0xFF;
+	if (f->data[9] == IP_UDP && sum == 0) return;  /* no UDP checksum */
+	sum = adjust_checksum(sum, old, sport);
+	if (f->data[9] == IP_UDP && sum == 0) sum = 0xFFFF;
+	l4[cs] = sum >> 8;
+	l4[cs+1] = sum & 0xFF;
+}
+
+/* Send 'count' frames, cycling through the slab, or keep cycling until
+ * 'duration' seconds have passed if that's set. */
+static void *run_worker(void *arg) {
+	Worker *w = (Worker*)arg;
+	w->start = monotonic_ns();
+	nsec_t stop = w->duration > 0 ? w->start + (nsec_t)(w->duration * 1e9) : 0;
+	for (unsigned long i=0; w->duration > 0 || i<w->count; i++) {
+		SlabFrame *f = &w->frames[i % w->nframes];
+		if (stop && (i % w->nframes) == 0 && monotonic_ns() >= stop) break;
+		if (w->port_span && f->l4 >= 0) partition_port(w, f);
+		w->pacer->wait(f->length);
+		if (stop && monotonic_ns() >= stop) break;
+		w->tx->send(f->data, f->length, f->dst, f->port);
+	}
+	w->tx->flush();
+	w->end = monotonic_ns();
+	return NULL;
+}
+
+static Transmitter *make_transmitter(int gso, int stamp, const char *device,
+		const unsigned char *dest_mac, int batch) {
+	if (gso)
+		return new GSOTransmitter(gso, stamp);
+	if (device)
+		return new RingTransmitter(device, dest_mac, batch);
+	return new RawTransmitter();
+}
+
+/* one rule per line; blank lines and #comments are skipped */
+static bool load_rules(Rewriter *rw, const char *filename) {
+	FILE *fp = fopen(filename, "r");
+	char line[256];
+	int n = 0;
+	if (!fp) {
+		perror(filename);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		n++;
+		char *p = line + strspn(line, " \t");
+		p[strcspn(p, "#\r\n")] = '\0';
+		for (int i=strlen(p)-1; i>=0 && (p[i] == ' ' || p[i] == '\t'); i--)
+			p[i] = '\0';
+		if (*p && !rw->add_rule(p)) {
+			fprintf(stderr, "%s:%d: bad rewrite rule \"%s\"\n", filename, n, p);
 			fclose(fp);
+			return false;
 		}
 	}
-	close(fd);
+	fclose(fp);
+	return true;
+}
+
+static double pacing_error_sum(void *arg) {
+	return ((Pacer *)arg)->error_sum() / 1e6;
+}
+
+static double pacing_error_count(void *arg) {
+	return ((Pacer *)arg)->error_count();
+}
+
+static double pacing_error_max(void *arg) {
+	return ((Pacer *)arg)->error_max() / 1e6;
+}
+
+/* Serve each transmitter's and pacer's counters, labelled by worker if
+ * there is more than one. */
+static void add_metrics(MetricsServer *ms, Transmitter **tx, Pacer **pacers,
+		int n) {
+	char **labels = g_new0(char*, n);
+	if (n > 1)
+		for (int i=0; i<n; i++)
+			labels[i] = g_strdup_printf("worker=\"%d\"", i);
+	for (int i=0; i<n; i++)
+		ms->counter("sender_packets_total", "Packets sent.", labels[i],
+			&tx[i]->packets);
+	for (int i=0; i<n; i++)
+		ms->counter("sender_bytes_total", "Bytes sent.", labels[i], &tx[i]->bytes);
+	for (int i=0; i<n; i++)
+		ms->counter("sender_errors_total", "Packets the socket refused.",
+			labels[i], &tx[i]->errors);
+	for (int i=0; i<n; i++)
+		ms->counter("sender_pacing_error_seconds_sum",
+			"Total lateness against the pacer's release times.", labels[i],
+			pacing_error_sum, pacers[i]);
+	for (int i=0; i<n; i++)
+		ms->counter("sender_pacing_error_seconds_count",
+			"Times the pacer waited.", labels[i], pacing_error_count, pacers[i]);
+	for (int i=0; i<n; i++)
+		ms->gauge("sender_pacing_error_max_seconds",
+			"Worst lateness against the pacer's release times.", labels[i],
+			pacing_error_max, pacers[i]);
+	/* the label strings stay, for as long as the server runs */
+	g_free(labels);
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] <filename> [<filename> ...]\n"
+		"       %s [options] --replay=<pcap file>\n"
+		"  -i, --interface=DEV   transmit through a PACKET_TX_RING on DEV\n"
+		"                        instead of an IPPROTO_RAW socket\n"
+		"  -m, --dest-mac=MAC    Ethernet destination for -i (default broadcast)\n"
+		"  -b, --batch=N         frames queued per TX ring kick (default 64)\n"
+		"  -c, --count=N         send N packets, cycling through the spec\n"
+		"  -d, --duration=SECS   keep cycling through the spec for SECS seconds\n"
+		"  -r, --pps=RATE        hold the send rate to RATE packets/s\n"
+		"  -B, --bps=RATE        hold the send rate to RATE bits/s\n"
+		"      --burst=N         let up to N packets go back to back (default 1)\n"
+		"      --ramp=PROFILE    scale the rate over time:\n"
+		"                        linear:FROM%%:TO%%:SECS or steps:PCT@SECS,...\n"
+		"  -g, --gso[=N]         send UDP through ordinary sockets, up to N datagrams\n"
+		"                        (default 64) per UDP_SEGMENT send\n"
+		"      --stamp=WHAT      with -g, stamp each datagram's payload with a\n"
+		"                        sequence number (seq), a timestamp (time) or both\n"
+		"  -w, --workers=N       generate from N threads, each with its own socket\n"
+		"      --split=HOW       divide work between workers: count (each sends a\n"
+		"                        disjoint part of the spec), rate[:W1,W2,...] (each\n"
+		"                        sends the whole spec at a weighted share of the\n"
+		"                        rate), or field (each sends the whole spec from\n"
+		"                        its own slice of source ports)\n"
+		"  -q, --quiet           don't dump each packet\n"
+		"  -M, --metrics=WHERE   serve counters for Prometheus over HTTP on\n"
+		"                        [ADDR:]PORT, or on a unix socket PATH\n"
+		"      --replay=FILE     retransmit the IPv4 packets in a pcap file\n"
+		"      --speed=FACTOR    replay FACTOR times faster than captured (default 1)\n"
+		"      --topspeed        replay as fast as possible (or at -r/-B)\n"
+		"      --rewrite=RULE    rewrite replayed headers; may be repeated:\n"
+		"                        src|dst|addr A.B.C.D/N=E.F.G.H/M,\n"
+		"                        sport|dport|port +K, ttl=N, tos=N\n"
+		"      --rewrite-file=F  read rewrite rules from F, one per line\n"
+		"RATE takes a k, M or G suffix.\n",
+		argv0, argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	enum { OPT_BURST = 256, OPT_RAMP, OPT_SPLIT, OPT_STAMP, OPT_REPLAY,
+		OPT_SPEED, OPT_TOPSPEED, OPT_REWRITE, OPT_REWRITE_FILE };
+	static struct option long_options[] = {
+		{ "interface", required_argument, NULL, 'i' },
+		{ "dest-mac", required_argument, NULL, 'm' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "count", required_argument, NULL, 'c' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "pps", required_argument, NULL, 'r' },
+		{ "bps", required_argument, NULL, 'B' },
+		{ "burst", required_argument, NULL, OPT_BURST },
+		{ "ramp", required_argument, NULL, OPT_RAMP },
+		{ "gso", optional_argument, NULL, 'g' },
+		{ "stamp", required_argument, NULL, OPT_STAMP },
+		{ "workers", required_argument, NULL, 'w' },
+		{ "split", required_argument, NULL, OPT_SPLIT },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "metrics", required_argument, NULL, 'M' },
+		{ "replay", required_argument, NULL, OPT_REPLAY },
+		{ "speed", required_argument, NULL, OPT_SPEED },
+		{ "topspeed", no_argument, NULL, OPT_TOPSPEED },
+		{ "rewrite", required_argument, NULL, OPT_REWRITE },
+		{ "rewrite-file", required_argument, NULL, OPT_REWRITE_FILE },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *device = NULL, *ramp = NULL, *replay_file = NULL;
+	unsigned char dest_mac[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	int batch = 64, burst = 1, nworkers = 1, split = SPLIT_COUNT;
+	int gso = 0, stamp = 0;
+	const char *weights = NULL;
+	unsigned long count = 0;
+	double duration = 0, pps = 0, bps = 0, speed = 1;
+	Rewriter rewriter;
+	MetricsServer *metrics = NULL;
+	int c, i;
+
+	while ((c = getopt_long(argc, argv, "i:m:b:c:d:r:B:g::w:qM:", long_options,
+			NULL)) != -1) {
+		switch (c) {
+			case 'i':
+				device = optarg;
+				break;
+			case 'm':
+				if (!parse_mac(optarg, dest_mac)) {
+					fprintf(stderr, "%s: bad MAC address \"%s\"\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'c':
+				count = strtoul(optarg, NULL, 10);
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'r':
+				pps = parse_rate(optarg);
+				break;
+			case 'B':
+				bps = parse_rate(optarg);
+				break;
+			case OPT_BURST:
+				burst = atoi(optarg);
+				break;
+			case OPT_RAMP:
+				ramp = optarg;
+				break;
+			case 'g':
+				gso = optarg ? atoi(optarg) : 64;
+				if (gso < 1) usage(argv[0]);
+				break;
+			case OPT_STAMP:
+				if (strstr(optarg, "seq")) stamp |= STAMP_SEQ;
+				if (strstr(optarg, "time")) stamp |= STAMP_TIME;
+				if (!stamp) usage(argv[0]);
+				break;
+			case 'w':
+				nworkers = atoi(optarg);
+				if (nworkers < 1) usage(argv[0]);
+				break;
+			case OPT_SPLIT:
+				if (!strcasecmp(optarg, "count"))
+					split = SPLIT_COUNT;
+				else if (!strcasecmp(optarg, "field"))
+					split = SPLIT_FIELD;
+				else if (!strncasecmp(optarg, "rate", 4)
+						&& (optarg[4] == '\0' || optarg[4] == ':')) {
+					split = SPLIT_RATE;
+					weights = optarg[4] ? optarg+5 : NULL;
+				}
+				else
+					usage(argv[0]);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'M':
+				metrics = new MetricsServer;
+				if (!metrics->listen(optarg)) exit(1);
+				break;
+			case OPT_REPLAY:
+				replay_file = optarg;
+				break;
+			case OPT_SPEED:
+				speed = atof(optarg);
+				if (speed <= 0) usage(argv[0]);
+				break;
+			case OPT_TOPSPEED:
+				speed = 0;
+				break;
+			case OPT_REWRITE:
+				if (!rewriter.add_rule(optarg)) {
+					fprintf(stderr, "%s: bad rewrite rule \"%s\"\n", argv[0], optarg);
+					exit(1);
+				}
+				break;
+			case OPT_REWRITE_FILE:
+				if (!load_rules(&rewriter, optarg)) exit(1);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	resolve_init(false);
+	if (gso && device) {
+		fprintf(stderr, "%s: -g and -i don't mix\n", argv[0]);
+		exit(1);
+	}
+
+	if (replay_file) {
+		Pacer pacer(pps, bps, burst);
+		Transmitter *tx = make_transmitter(gso, stamp, device, dest_mac, batch);
+		rewriter.compile();
+		Pacer *pp = &pacer;
+		if (metrics) {
+			add_metrics(metrics, &tx, &pp, 1);
+			if (!metrics->start()) exit(1);
+		}
+		bool ok = replay(replay_file, tx, &pacer, speed, &rewriter);
+		delete metrics;
+		delete tx;
+		return ok ? 0 : 1;
+	}
+
+	for (i=optind; i<argc; i++) {
+		SpecFile sf(argv[i]);
+		if (sf.ok()) load(sf);
+	}
+	if (nframes == 0) return 0;
+	if (count == 0) count = nframes;
+	if (split == SPLIT_COUNT && nworkers > nframes) {
+		fprintf(stderr, "%s: only %d packets to divide between %d workers\n",
+			argv[0], nframes, nworkers);
+		nworkers = nframes;
+	}
+
+	/* each worker's share of the rate and the count */
+	double *share = g_new(double, nworkers), total = 0;
+	const char *p = weights;
+	for (i=0; i<nworkers; i++) {
+		share[i] = 1;
+		if (p && *p) {
+			share[i] = atof(p);
+			p = strchr(p, ',');
+			if (p) p++;
+		}
+		total += share[i];
+	}
+
+	Worker *workers = g_new0(Worker, nworkers);
+	unsigned long assigned = 0;
+	for (i=0; i<nworkers; i++) {
+		Worker *w = &workers[i];
+		double f = share[i] / total;
+		w->index = i;
+		w->pacer = new Pacer(pps * f, bps * f, burst);
+		if (ramp && !w->pacer->set_ramp(ramp)) {
+			fprintf(stderr, "%s: bad ramp profile \"%s\"\n", argv[0], ramp);
+			exit(1);
+		}
+		w->count = i == nworkers-1 ? count - assigned : (unsigned long)(count * f);
+		assigned += w->count;
+		w->duration = duration;
+		w->rng = (unsigned int)time(NULL) ^ ((i+1) * 0x9E3779B9u);
+		if (w->rng == 0) w->rng = 1;
+		if (split == SPLIT_COUNT)
+			build_slab(w, i, nworkers);
+		else
+			build_slab(w, 0, 1);
+		if (split == SPLIT_FIELD) {
+			w->port_span = (65536 - 1024) / nworkers;
+			w->port_lo = 1024 + i * w->port_span;
+		}
+		w->tx = make_transmitter(gso, stamp, device, dest_mac, batch);
+	}
+	g_free(share);
+	if (metrics) {
+		Transmitter **txs = g_new(Transmitter*, nworkers);
+		Pacer **pacers = g_new(Pacer*, nworkers);
+		for (i=0; i<nworkers; i++) {
+			txs[i] = workers[i].tx;
+			pacers[i] = workers[i].pacer;
+		}
+		add_metrics(metrics, txs, pacers, nworkers);
+		g_free(txs);
+		g_free(pacers);
+		if (!metrics->start()) exit(1);
+	}
+
+	if (nworkers == 1)
+		run_worker(&workers[0]);
+	else {
+		for (i=0; i<nworkers; i++)
+			if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i])) {
+				perror("pthread_create");
+				exit(1);
+			}
+		for (i=0; i<nworkers; i++)
+			pthread_join(workers[i].thread, NULL);
+	}
+
+	delete metrics;
+
+	/* merge the per-worker statistics */
+	Pacer pacer(0, 0, 1);
+	unsigned long packets = 0, errors = 0, evictions = 0;
+	unsigned long long bytes = 0;
+	nsec_t first = 0, last = 0;
+	for (i=0; i<nworkers; i++) {
+		Worker *w = &workers[i];
+		double secs = (w->end - w->start) / 1e9;
+		if (nworkers > 1)
+			fprintf(stderr, "worker %d: %lu packets, %lu errors, %.0f pps\n", i,
+				w->tx->packets, w->tx->errors, secs > 0 ? w->tx->packets / secs : 0.0);
+		packets += w->tx->packets;
+		bytes += w->tx->bytes;
+		errors += w->tx->errors;
+		if (gso) evictions += ((GSOTransmitter*)w->tx)->evictions;
+		if (i == 0 || w->start < first) first = w->start;
+		if (w->end > last) last = w->end;
+		pacer.merge(*w->pacer);
+		delete w->tx;
+		delete w->pacer;
+		g_free(w->frames);
+		g_free(w->slab);
+	}
+	g_free(workers);
+	if (pacer.active()) pacer.report(stderr);
+	if (evictions)
+		fprintf(stderr, "GSO: %lu flow sockets closed early, over %d flows per "
+			"worker\n", evictions, GSO_MAX_FLOWS);
+	double secs = (last - first) / 1e9;
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(stderr, "sent %lu packets, %llu bytes, %lu errors in %.3f s",
+		packets, bytes, errors, secs);
+	if (secs > 0)
+		fprintf(stderr, ": %.0f pps, %.0f bps", packets / secs, bytes * 8 / secs);
+	double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+	fprintf(stderr, "; cpu %.3f s\n", cpu);
+	/* the same again, for scripts */
+	fprintf(stderr, "stats: packets=%lu bytes=%llu errors=%lu secs=%.3f cpu=%.3f\n",
+		packets, bytes, errors, secs, cpu);
+
+	for (i=0; i<nframes; i++) delete frames[i];
+	g_free(frames);
 	return 0;
 }
@@ -28,6 +28,7 @@
 #include <sys/time.h>
 
 #include <signal.h>
+#include <errno.h>
 #if __GLIBC__ >= 2
 #include <net/ethernet.h>
 #include <netinet/tcp.h>
@@ -39,127 +40,857 @@
 #include <linux/if_packet.h>
 #include <arpa/inet.h>
 #include <resolv.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <netinet/ip.h>
+#include <glib.h>
+#include "blockfile.h"
 #include "buffer.h"
+#include "capindex.h"
+#include "columnar.h"
+#include "counters.h"
+#include "dedup.h"
+#include "ether.h"
+#include "filter.h"
+#include "match.h"
+#include "pipeline.h"
+#include "format.h"
+#include "metrics.h"
 #include "ippacket.h"
-
-#define DEBUG
+#include "pcap.h"
+#include "recorder.h"
+#include "sample.h"
+#include "resolve.h"
+#include "trigger.h"
 
 #define DEFAULT_DEVICE "eth0"
+#define MAX_FRAME 70000
+#define MAX_INTERFACES 16
+#define READ_BATCH 64       /* frames from one socket before the next */
+#define DRAIN_MAX 65536     /* frames per socket to read after a signal */
+
+/* one capture socket per interface */
+struct Interface {
+  const char *name;
+  int fd;
+  unsigned long frames;
+  char label[IFNAMSIZ + 16];  /* interface="name", for metrics */
+};
+
+static Interface interfaces[MAX_INTERFACES];
+static int ninterfaces = 0;
+static unsigned char rxbuf[MAX_FRAME + 4];
 
 void die(int ignored);
+void dump_signal(int ignored);
+static void dump_page(FILE *fp, void *arg);
+
+int init_socket(const char *device, bool promisc);
+static int next_frame(Interface **ifc, unsigned char **frame, Formatter *f,
+  int idle);
+static double sample_skipped(void *arg);
+static double socket_dropped(void *arg);
+static double queue_depth(void *arg);
+static double recorder_frames(void *arg);
+static double recorder_bytes(void *arg);
+static double reorder_depth(void *arg);
+static double worker_busy(void *arg);
+static double capture_stall(void *arg);
+static double output_wait(void *arg);
+
+static volatile sig_atomic_t quit = 0;
 
-int init_socket(const char *device);
-void done_socket(int fd, const char *device);
+/* a flight recorder dump, asked for from a signal handler or the metrics
+ * thread: next_frame() wakes on wake_fd so the capture loop, which owns
+ * the recorder, hands it to the writer at once */
+enum { DUMP_SIGNAL = 1, DUMP_REQUEST };
+static volatile sig_atomic_t dump_wanted = 0;
+static int wake_fd = -1;
+#define WAKE_EVENT MAX_INTERFACES
 
-static int quit = 0;
-static int old_eth_flags;
+/* what the capture loop has done so far; only it writes these, and the
+ * metrics server reads them in place */
+static struct {
+  unsigned long packets, filter_misses, decode_errors;
+  unsigned long matched, matches;
+  unsigned long long bytes;
+} stats;
+
+/* what the capture loop found out about a packet, for printing it */
+#define MAX_MATCHES 16
+struct Decoded {
+  IPPacket *ip;
+  int nfound;  /* signature matches, to log after the packet */
+  struct {
+    int id, end;
+  } found[MAX_MATCHES];
+};
+
+static void note_match(int id, int end, void *arg) {
+  Decoded *d = (Decoded *)arg;
+  if (d->nfound < MAX_MATCHES) {
+    d->found[d->nfound].id = id;
+    d->found[d->nfound].end = end;
+    d->nfound++;
+  }
+}
+
+static void print_packet(Formatter &f, const PipelineItem &item, void *arg);
+static void print_queued(Formatter &f, const PipelineItem &item, void *arg);
+static Pipeline *pipeline;
 
 void hostup(unsigned long hst, int size);
 void htprint();
 void htdone();
 
 int main(int argc, char **argv) {
-  int sock;
-  const char *device = DEFAULT_DEVICE;
-	unsigned char buf[70000];
-  int size;
-
-#if 0
-  signal(SIGINT, die);
-  signal(SIGTERM, die);
-  signal(SIGABRT, die);
-  signal(SIGHUP, die);
-  signal(SIGALRM, die);
-#endif
+  Interface *ifc;
+  unsigned char *buf;
+  int size, c;
+  bool promisc = false;
+  bool reverse_dns = false;
+  int mode = FORMAT_TEXT;
+  ColumnWriter *columns = NULL;
+  PcapWriter *capture = NULL;
+  IndexWriter *index = NULL;
+  BlockWriter *compressed = NULL;
+  Filter filter;
+  EtherClassifier ether;
+  Sampler sampler;
+  double estimate = 0;
+  const char *windows_file = NULL;
+  WindowCollector *windows = NULL;
+  TrafficCounters *counters = NULL;
+  bool count_only = false;
+  int idle = 0;
+  MetricsServer *metrics = NULL;
+  Deduper *dedup = NULL;
+  Matcher *matcher = NULL;
+  int workers = 0;
+  FlightRecorder *recorder = NULL;
+  Filter dump_on;
+  long long quiet_until = 0;  /* no filter-triggered dumps before then */
+  Trigger *trigger = NULL;
 
-  sock = init_socket(device);
+  while ((c = getopt(argc, argv, "Ro:C:w:Z:i:pf:m:P:ct:s:D:F:d:T:W:M:")) != -1) {
+    switch (c) {
+      case 'i':
+        /* may be repeated, or a comma-separated list */
+        for (char *name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+          if (ninterfaces == MAX_INTERFACES) {
+            fprintf(stderr, "%s: at most %d interfaces\n", argv[0], MAX_INTERFACES);
+            exit(1);
+          }
+          interfaces[ninterfaces++].name = name;
+        }
+        break;
+      case 'p':
+        promisc = true;
+        break;
+      case 'f':
+        if (!filter.compile(optarg)) exit(1);
+        break;
+      case 'm':
+        matcher = new Matcher;
+        if (!matcher->load(optarg) || !matcher->compile()) exit(1);
+        break;
+      case 'P':
+        if ((workers = atoi(optarg)) < 1 || workers > PIPELINE_WORKERS) {
+          fprintf(stderr, "%s: -P takes 1 to %d workers\n", argv[0],
+            PIPELINE_WORKERS);
+          exit(1);
+        }
+        break;
+      case 'c':
+        count_only = true;
+        break;
+      case 't':
+        idle = atoi(optarg);
+        break;
+      case 's':
+        if (!sampler.parse(optarg)) {
+          fprintf(stderr, "%s: bad sampling \"%s\"\n", argv[0], optarg);
+          exit(1);
+        }
+        break;
+      case 'D':
+        if (!(dedup = Deduper::parse(optarg))) {
+          fprintf(stderr, "%s: bad dedup window \"%s\"\n", argv[0], optarg);
+          exit(1);
+        }
+        break;
+      case 'F':
+        if (!(recorder = FlightRecorder::parse(optarg))) {
+          fprintf(stderr, "%s: bad recorder size \"%s\"\n", argv[0], optarg);
+          exit(1);
+        }
+        break;
+      case 'd':
+        if (!dump_on.compile(optarg)) exit(1);
+        break;
+      case 'T':
+        trigger = new Trigger;
+        if (!trigger->parse(optarg)) exit(1);
+        break;
+      case 'W':
+        windows_file = optarg;
+        break;
+      case 'M':
+        metrics = new MetricsServer;
+        if (!metrics->listen(optarg)) exit(1);
+        break;
+      case 'R':
+        reverse_dns = true;
+        break;
+      case 'o':
+        if ((mode = parse_format(optarg)) < 0) {
+          fprintf(stderr, "%s: unknown output format \"%s\"\n", argv[0], optarg);
+          exit(1);
+        }
+        break;
+      case 'C':
+        columns = new ColumnWriter(optarg);
+        if (!columns->ok()) exit(1);
+        break;
+      case 'w': {
+        capture = new PcapWriter(optarg, LINK_ETHERNET, MAX_FRAME);
+        char *name = g_strdup_printf("%s.idx", optarg);
+        index = new IndexWriter(name);
+        g_free(name);
+        if (!capture->ok() || !index->ok()) exit(1);
+        break;
+      }
+      case 'Z':
+        compressed = new BlockWriter(optarg, LINK_ETHERNET, MAX_FRAME);
+        if (!compressed->ok()) exit(1);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-i device[,device...]] [-p] [-f filter]\n"
+          "       [-m signatures] [-P workers] [-s sampling] [-D ms[:slots]]\n"
+          "       [-F secs[:MB[:prefix]]] [-d filter] [-T trigger] [-c]\n"
+          "       [-t secs] [-R] [-o text|json|csv] [-W file]\n"
+          "       [-M [addr:]port|path] [-C file] [-w file] [-Z file]\n"
+          "  -i  capture on these devices (default " DEFAULT_DEVICE "); may be\n"
+          "      repeated.  With more than one, records name their device;\n"
+          "      files (-w, -Z, -C, -F, -T) need just one.\n"
+          "  -p  put the devices in promiscuous mode while capturing\n"
+          "  -f  only take packets matching this filter (see filter.h)\n"
+          "  -m  look for the signatures in this file in TCP and UDP data,\n"
+          "      and log each match (see match.h)\n"
+          "  -P  decode and print packets on this many threads, keeping\n"
+          "      their order (see pipeline.h)\n"
+          "  -s  keep 1 in N frames: N, flow:N (whole flows), or auto[:MAX]\n"
+          "      (flows, more sparsely as the socket backlog grows)\n"
+          "  -D  drop frames repeating one seen within ms milliseconds\n"
+          "  -F  keep the last secs of frames, up to MB megabytes (default 64),\n"
+          "      in memory, and write them to prefix-TIME-N.pcap on SIGUSR1,\n"
+          "      on a request for /dump from -M, or as -d says\n"
+          "  -d  dump the recorder when a packet matches this filter, at most\n"
+          "      once per secs\n"
+          "  -T  write pcap files around events, e.g. \"flags RST;rate=100/1\"\n"
+          "      (see trigger.h)\n"
+          "  -c  only count packets\n"
+          "  -t  stop after this many seconds without a packet\n"
+          "  -R  show host names, looked up in the background\n"
+          "  -o  output format (default text)\n"
+          "  -W  write per-second and per-minute traffic counts to file\n"
+          "  -M  serve counters for Prometheus over HTTP on this port or socket\n"
+          "  -C  write header fields to a columnar file instead\n"
+          "  -w  write packets to a pcap file, indexed in file.idx, instead\n"
+          "  -Z  write packets to a compressed capture file instead\n",
+          argv[0]);
+        exit(1);
+    }
+  }
+  /* pcap and columnar files have no field to say which device a frame
+   * came in on, and a merged file can't be pulled apart again */
+  if (ninterfaces > 1 && (capture || compressed || columns || recorder
+      || trigger)) {
+    fprintf(stderr, "%s: -w, -Z, -C, -F and -T take one interface\n", argv[0]);
+    exit(1);
+  }
+  resolve_init(reverse_dns);
+  Formatter f(STDOUT_FILENO, mode);
+  Formatter *wf = NULL;
+  FILE *wfp = NULL;
+  if (windows_file) {
+    if (!(wfp = fopen(windows_file, "w"))) {
+      perror(windows_file);
+      exit(1);
+    }
+    wf = new Formatter(wfp, mode);
+    windows = new WindowCollector(1, wf);
+    if (!windows->ok()) exit(1);
+    counters = windows->core(0);
+  }
+
+  /* stop cleanly: read what the sockets already hold, write the last
+   * partial chunk or block, and print the totals */
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = die;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  if (!dump_on.empty() && !recorder) {
+    fprintf(stderr, "%s: -d needs a recorder (-F)\n", argv[0]);
+    exit(1);
+  }
+  if (recorder) {
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+      perror("eventfd");
+      exit(1);
+    }
+    sa.sa_handler = dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+  }
 
-  while (!quit) {
-    if ((size = recv(sock, buf, sizeof(buf), 0))) {
-			if (buf[12] != 0x08 || buf[13] != 0x00) continue;  /* not IP */
-			Buffer b(buf+14, size-14);
-			printf("buffer = { "); b.print(); printf(" }\n");
-			IPPacket ip(b);
-			ip.print(stdout);
+  if (ninterfaces == 0) interfaces[ninterfaces++].name = DEFAULT_DEVICE;
+  int fds[MAX_INTERFACES];
+  for (int i=0; i<ninterfaces; i++) {
+    interfaces[i].fd = fds[i] = init_socket(interfaces[i].name, promisc);
+    snprintf(interfaces[i].label, sizeof(interfaces[i].label),
+      "interface=\"%s\"", interfaces[i].name);
+  }
+  bool printing = !(count_only || columns || capture || compressed);
+  bool announce = sampler.enabled();
+  if (workers && printing) {
+    pipeline = new Pipeline(workers, mode, STDOUT_FILENO, print_queued, matcher);
+    if (!pipeline->ok()) exit(1);
+    if (metrics) {
+      for (int i=0; i<pipeline->workers(); i++)
+        metrics->gauge("sniff_pipeline_queue_depth",
+          "Batches of packets queued at a worker.", pipeline->worker(i)->label,
+          queue_depth, pipeline->worker(i));
+      metrics->gauge("sniff_pipeline_reorder_depth", "Batches done but "
+        "waiting to be written behind an earlier one.", NULL, reorder_depth,
+        pipeline);
+      for (int i=0; i<pipeline->workers(); i++)
+        metrics->counter("sniff_pipeline_busy_seconds_total",
+          "Time workers spent decoding and formatting.",
+          pipeline->worker(i)->label, worker_busy, pipeline->worker(i));
+      metrics->counter("sniff_pipeline_capture_stall_seconds_total",
+        "Time capture waited for a free batch.", NULL, capture_stall, pipeline);
+      metrics->counter("sniff_pipeline_output_wait_seconds_total",
+        "Time output waited for the next batch in order.", NULL, output_wait,
+        pipeline);
+    }
+  }
+  if (metrics) {
+    for (int i=0; i<ninterfaces; i++)
+      metrics->counter("sniff_frames_total", "Frames received.",
+        interfaces[i].label, &interfaces[i].frames);
+    for (int i=0; i<ninterfaces; i++)
+      metrics->counter("sniff_drops_total",
+        "Frames the kernel dropped for want of socket buffer.",
+        interfaces[i].label, socket_dropped, &interfaces[i]);
+    if (dedup)
+      metrics->counter("sniff_duplicates_total",
+        "Frames dropped as copies of recent ones.", NULL, &dedup->duplicates);
+    metrics->counter("sniff_sampled_out_total", "Frames skipped by sampling.",
+      NULL, sample_skipped, &sampler);
+    metrics->gauge("sniff_sample_rate", "Current sampling rate, 1 in N.", NULL,
+      &sampler.rate);
+    metrics->counter("sniff_decode_errors_total",
+      "Frames too short or malformed to decode.", NULL, &stats.decode_errors);
+    metrics->counter("sniff_filter_hits_total", "Packets taken: matching the "
+      "filter, if there is one.", NULL, &stats.packets);
+    metrics->counter("sniff_filter_misses_total",
+      "Packets not matching the filter.", NULL, &stats.filter_misses);
+    metrics->counter("sniff_bytes_total", "Bytes in the packets taken.", NULL,
+      &stats.bytes);
+    if (recorder) {
+      metrics->gauge("sniff_recorder_frames", "Frames held by the flight "
+        "recorder.", NULL, recorder_frames, recorder);
+      metrics->gauge("sniff_recorder_bytes", "Bytes of frames held by the "
+        "flight recorder.", NULL, recorder_bytes, recorder);
+      metrics->counter("sniff_recorder_dumps_total",
+        "Flight recorder dumps written.", NULL, &recorder->dumps);
+      metrics->page("/dump", dump_page, NULL);
     }
+    if (trigger) {
+      metrics->counter("sniff_trigger_matches_total",
+        "Frames matching the trigger's filter.", NULL, &trigger->matches);
+      metrics->counter("sniff_trigger_fires_total",
+        "Times the trigger started a file.", NULL, &trigger->fires);
+      metrics->counter("sniff_trigger_written_total",
+        "Frames the trigger wrote, history included.", NULL, &trigger->written);
+      metrics->counter("sniff_trigger_lost_total",
+        "Frames left out of trigger files with the disk behind.", NULL,
+        &trigger->lost);
+    }
+    if (matcher) {
+      metrics->counter("sniff_matched_packets_total",
+        "Packets taken with a signature in their data.", NULL, &stats.matched);
+      metrics->counter("sniff_signature_matches_total",
+        "Signature matches in packet data.", NULL, &stats.matches);
+    }
+    if (!metrics->start()) exit(1);
+  }
+
+  while ((size = next_frame(&ifc, &buf, &f, idle)) != 0) {
+			if (dump_wanted) {
+				int why = dump_wanted;
+				dump_wanted = 0;
+				recorder->dump(why == DUMP_SIGNAL ? "SIGUSR1" : "requested");
+			}
+			if (size < 0) continue;  /* only woken for the dump */
+			ifc->frames++;
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			long long ts = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+			/* copies from the span port or tap go first, so that nothing
+			 * downstream counts them */
+			if (dedup && dedup->duplicate(buf, size, ts)) continue;
+
+			/* per ethertype and VLAN, before sampling, like the windows */
+			EtherFrame ef;
+			int cls = ether.classify(buf, size, &ef);
+			bool is_ip = cls == ETHER_IPV4 && ef.length >= 20
+				&& (ef.payload[0] >> 4) == 4;
+
+			/* the recorder keeps everything, and writes it out when the
+			 * trigger filter first matches */
+			if (recorder) {
+				recorder->add(ts, buf, size, size);
+				unsigned int v[NFIELDS];
+				if (!dump_on.empty() && ts >= quiet_until && is_ip
+						&& datagram_fields(ef.payload, ef.length, v) && dump_on.match(v)) {
+					recorder->dump("filter matched");
+					quiet_until = ts + recorder->span();
+				}
+			}
+			if (trigger) trigger->frame(ts, buf, size, size);
+
+			/* counted before sampling: the windows cover all traffic */
+			if (counters) traffic_count(counters, buf, size, size);
+
+			/* shed load before spending anything on decoding */
+			if (sampler.adapt(fds, ninterfaces)) announce = true;
+			if (!sampler.keep(buf, size)) continue;
+
+			/* decode only if something needs the fields; with a pipeline,
+			 * printing decodes on its own threads */
+			IPPacket *ip = NULL;
+			if (cls == ETHER_BAD || (cls == ETHER_IPV4 && !is_ip))
+				stats.decode_errors++;
+			if (is_ip && (!filter.empty() || columns || (printing && !pipeline))) {
+				Buffer b(ef.payload, ef.length);
+				ip = new IPPacket(b);
+			}
+			if (!filter.empty() && (!ip || !filter.match(*ip))) {
+				stats.filter_misses++;
+				delete ip;
+				continue;
+			}
+			stats.packets++;
+			stats.bytes += size;
+			estimate += sampler.rate;
+
+			if (compressed) compressed->write(ts, buf, size, size);
+			if (capture) {
+				PcapRecord rec;
+				rec.ts = ts;
+				rec.data = buf;
+				rec.caplen = rec.len = size;
+				long offset = capture->write(ts, buf, size, size);
+				/* index entries only ever point at data already written */
+				if (index->add(rec, offset, LINK_ETHERNET)) {
+					capture->flush();
+					index->close_block();
+				}
+			}
+			/* signatures are looked for in the captured bytes, in place */
+			Decoded d;
+			d.ip = ip;
+			d.nfound = 0;
+			const unsigned char *data;
+			int dlen;
+			if (matcher && is_ip && (data = ip_payload(ef.payload, ef.length, &dlen))) {
+				int n = matcher->scan(data, dlen, printing ? note_match : NULL, &d);
+				if (n) {
+					stats.matched++;
+					stats.matches += n;
+				}
+			}
+
+			if (columns && ip) columns->add(ts, *ip);
+			if (printing && is_ip) {
+				/* a Sample record says what the records after it stand for */
+				int note = announce ? sampler.rate : 0;
+				announce = false;
+				if (pipeline) {
+					Decoded *copy = NULL;
+					if (d.ip || d.nfound) {
+						copy = g_new(Decoded, 1);
+						*copy = d;
+					}
+					pipeline->add(ts, buf, size, ifc - interfaces, note, copy);
+					continue;
+				}
+				PipelineItem item = { ts, buf, size, (int)(ifc - interfaces), note, &d };
+				print_packet(f, item, matcher);
+			}
+			delete ip;
 	}
+  if (pipeline) pipeline->stop();
+  f.flush();
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  long drops = 0;
+  for (int i=0; i<ninterfaces; i++) {
+    long n = socket_drops(interfaces[i].fd);
+    if (n > 0) drops += n;  /* -1: the kernel doesn't say */
+  }
+  double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+    + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+  fprintf(stderr, "sniff: %lu packets, %llu bytes, cpu %.3f s; %ld dropped\n",
+    stats.packets, stats.bytes, cpu, drops);
+  /* the same again, for scripts */
+  fprintf(stderr, "stats: packets=%lu bytes=%llu dropped=%ld cpu=%.3f\n",
+    stats.packets, stats.bytes, drops, cpu);
+  if (ninterfaces > 1)
+    for (int i=0; i<ninterfaces; i++)
+      fprintf(stderr, "  %s: %lu frames, %ld dropped\n", interfaces[i].name,
+        interfaces[i].frames, socket_drops(interfaces[i].fd));
+  ether.print(stderr);
+  if (sampler.enabled())
+    fprintf(stderr, "sampling: kept %lu of %lu frames, 1 in %d at the end;"
+      " about %.0f packets matched\n", sampler.kept, sampler.seen,
+      sampler.rate, estimate);
+  delete metrics;
+  if (pipeline) {
+    pipeline->report(stderr);
+    delete pipeline;
+  }
+  if (matcher) {
+    fprintf(stderr, "%lu packets matched signatures, %lu matches\n",
+      stats.matched, stats.matches);
+    matcher->report(stderr);
+    delete matcher;
+  }
+  if (recorder) {
+    if (recorder->refused)
+      fprintf(stderr, "recorder: %lu dumps refused, the last still being "
+        "written\n", recorder->refused);
+    delete recorder;
+  }
+  if (trigger) {
+    trigger->stop();
+    trigger->report(stderr);
+    delete trigger;
+  }
+  if (dedup) {
+    dedup->report(stderr);
+    delete dedup;
+  }
+  if (windows) {
+    delete windows;
+    delete wf;
+    fclose(wfp);
+  }
+  if (capture) {
+    capture->flush();
+    delete index;
+    fprintf(stderr, "%lu packets, %ld bytes captured\n", capture->records,
+      capture->offset);
+    delete capture;
+  }
+  if (compressed) {
+    compressed->close();
+    fprintf(stderr, "%lu packets, %lld bytes compressed to %lld\n",
+      compressed->records, compressed->raw_bytes, compressed->bytes);
+    delete compressed;
+  }
+  if (columns) {
+    columns->flush();
+    fprintf(stderr, "%lu packets, %lu bytes written\n", columns->rows,
+      columns->bytes);
+    delete columns;
+  }
 
-  done_socket(sock, device);
+  /* closing drops the promiscuous membership, too */
+  for (int i=0; i<ninterfaces; i++)
+    close(interfaces[i].fd);
 
   return 0;
 }
 
-int init_socket(const char *device) {
-  struct ifreq iface_request;
-	struct sockaddr_pkt spkt;
-  int fd;
+static double socket_dropped(void *arg) {
+  return socket_drops(((Interface *)arg)->fd);
+}
 
-  /* open a raw IP socket */
-  //if ((fd = socket(AF_INET, SOCK_PACKET, htons(ETH_P_IP))) < 0) {
-  if ((fd = socket(AF_INET, SOCK_PACKET, 0x300)) < 0) {
-    perror("init_socket: socket");
-    exit(-1);
+static double sample_skipped(void *arg) {
+  const Sampler *s = (const Sampler *)arg;
+  return __atomic_load_n(&s->seen, __ATOMIC_RELAXED)
+    - __atomic_load_n(&s->kept, __ATOMIC_RELAXED);
+}
+
+static double recorder_frames(void *arg) {
+  const FlightRecorder *r = (const FlightRecorder *)arg;
+  return __atomic_load_n(&r->frames, __ATOMIC_RELAXED);
+}
+
+static double recorder_bytes(void *arg) {
+  const FlightRecorder *r = (const FlightRecorder *)arg;
+  return __atomic_load_n(&r->bytes, __ATOMIC_RELAXED);
+}
+
+static double queue_depth(void *arg) {
+  const Pipeline::Worker *w = (const Pipeline::Worker *)arg;
+  return __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)
+    - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+}
+
+static double reorder_depth(void *arg) {
+  return ((const Pipeline *)arg)->reorder_depth();
+}
+
+static double worker_busy(void *arg) {
+  const Pipeline::Worker *w = (const Pipeline::Worker *)arg;
+  return __atomic_load_n(&w->busy_ns, __ATOMIC_RELAXED) / 1e9;
+}
+
+static double capture_stall(void *arg) {
+  return ((const Pipeline *)arg)->capture_stall();
+}
+
+static double output_wait(void *arg) {
+  return ((const Pipeline *)arg)->output_wait();
+}
+
+/* One packet's records: the packet, then any signature matches.  item.ptr
+ * is a Decoded, or NULL if nothing has been decoded yet. */
+static void print_packet(Formatter &f, const PipelineItem &item, void *arg) {
+  const Matcher *matcher = (const Matcher *)arg;
+  Decoded *d = (Decoded *)item.ptr;
+  if (item.note) {
+    f.begin("Sample");
+    f.field("rate", item.note);
+    f.end();
+    f.end_record();
   }
+  EtherFrame ef;
+  ether_classify(item.frame, item.len, &ef);
+  IPPacket *ip = d ? d->ip : NULL;
+  if (!ip) {
+    Buffer b(ef.payload, ef.length);
+    ip = new IPPacket(b);
+  }
+  if (f.get_mode() == FORMAT_TEXT) f.dump(ef.payload, ef.length);
+  if (ninterfaces > 1) f.tag("interface", interfaces[item.source].name);
+  ip->format(f);
+  f.end_record();
+  for (int i=0; d && i<d->nfound; i++) {
+    f.begin("Match");
+    f.field_str("signature", matcher->name(d->found[i].id));
+    f.field("offset", d->found[i].end);
+    f.end();
+    f.end_record();
+  }
+  if (!d || ip != d->ip) delete ip;
+}
 
-	spkt.spkt_family = PF_INET;
-	strcpy((char*)spkt.spkt_device, DEFAULT_DEVICE);
-	spkt.spkt_protocol = 0;
-	if (bind(fd, (struct sockaddr*)&spkt, 16) == -1) {
-		perror("bind");
-		exit(1);
-	}
+/* the same, on a pipeline worker, which owns what the capture loop found */
+static void print_queued(Formatter &f, const PipelineItem &item, void *arg) {
+  print_packet(f, item, arg);
+  Decoded *d = (Decoded *)item.ptr;
+  if (d) {
+    delete d->ip;
+    g_free(d);
+  }
+}
 
-  /* get device flags for this socket / the device */
-  strcpy(iface_request.ifr_name, device);
-  if ((ioctl(fd, SIOCGIFFLAGS, &iface_request)) < 0) {
-    perror("init_socket: ioctl(get)");
-    close(fd);
+/* A non-blocking packet socket on one device.  Receive VLAN offload
+ * takes the outer tag out of the frame; PACKET_AUXDATA hands it back, so
+ * receive() can put it back in. */
+int init_socket(const char *device, bool promisc) {
+  int fd, one = 1;
+  struct sockaddr_ll sll;
+
+  /* protocol 0 until bound, so no other device's traffic slips in */
+  if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+    perror("init_socket: socket");
     exit(-1);
   }
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  if ((sll.sll_ifindex = if_nametoindex(device)) == 0) {
+    perror(device);
+    exit(1);
+  }
+  if (bind(fd, (struct sockaddr*)&sll, sizeof(sll)) == -1) {
+    perror("bind");
+    exit(1);
+  }
+  setsockopt(fd, SOL_PACKET, PACKET_AUXDATA, &one, sizeof(one));
 
-#if 0
-  /* set promiscuous mode */
-  old_eth_flags = iface_request.ifr_flags;
-  iface_request.ifr_flags |= IFF_PROMISC;
-  if ((ioctl(fd, SIOCSIFFLAGS, &iface_request)) < 0) {
-    perror("init_socket: ioctl(set)");
-    close(fd);
-    exit(-1);
+  if (promisc) {
+    /* the kernel undoes this when the socket closes, however we exit */
+    struct packet_mreq mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = sll.sll_ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
+      perror("init_socket: promiscuous mode");
+      exit(-1);
+    }
   }
-#endif
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
   return fd;
 }
 
-void done_socket(int fd, const char *device) {
-  struct ifreq iface_request;
+/* Read a frame from one socket into rxbuf, restoring any VLAN tag the
+ * kernel took out.  Returns its length, or -1 if there is none. */
+static int receive(Interface *ifc, unsigned char **frame) {
+  /* 4 bytes of headroom for a tag */
+  struct iovec iov = { rxbuf + 4, MAX_FRAME };
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &control;
+  msg.msg_controllen = sizeof(control);
+  int n = recvmsg(ifc->fd, &msg, 0);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EINTR) perror(ifc->name);
+    return -1;
+  }
+  *frame = rxbuf + 4;
+  for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level != SOL_PACKET || cm->cmsg_type != PACKET_AUXDATA)
+      continue;
+    struct tpacket_auxdata *aux = (struct tpacket_auxdata *)CMSG_DATA(cm);
+    if (!(aux->tp_status & TP_STATUS_VLAN_VALID) || n < 12) continue;
+    int tpid = aux->tp_status & TP_STATUS_VLAN_TPID_VALID ? aux->tp_vlan_tpid
+      : 0x8100;
+    memmove(rxbuf, rxbuf + 4, 12);
+    rxbuf[12] = tpid >> 8;
+    rxbuf[13] = tpid;
+    rxbuf[14] = aux->tp_vlan_tci >> 8;
+    rxbuf[15] = aux->tp_vlan_tci;
+    *frame = rxbuf;
+    n += 4;
+  }
+  return n;
+}
 
-  /* raw IP socket is already open */
+/* The next frame from any interface, and the interface it came in on.
+ * Ready sockets are read READ_BATCH frames at a time, in turn; output is
+ * flushed whenever they all run dry.  Returns 0 to stop: after 'idle'
+ * seconds with nothing (if idle > 0), or once a signal has come and
+ * what the sockets held at that point has been read. */
+static int next_frame(Interface **ifc, unsigned char **frame, Formatter *f,
+    int idle) {
+  static int ep = -1;
+  static struct epoll_event ready[MAX_INTERFACES + 1];
+  static int nready = 0, pos = 0, budget = 0, timeout = 0;
+  static bool draining = false;
+  static int drain_at = 0, drained = 0;
+  int n;
 
-  /* get device flags for this socket / the device */
-  strcpy(iface_request.ifr_name, device);
-  if ((ioctl(fd, SIOCGIFFLAGS, &iface_request)) < 0) {
-    perror("done_socket: ioctl(get)");
-    close(fd);
-    exit(-1);
+  if (ep < 0) {
+    if ((ep = epoll_create1(0)) < 0) {
+      perror("epoll_create1");
+      exit(1);
+    }
+    for (int i=0; i<=ninterfaces; i++) {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u32 = i < ninterfaces ? i : WAKE_EVENT;
+      int fd = i < ninterfaces ? interfaces[i].fd : wake_fd;
+      if (fd >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+      }
+    }
   }
 
-  /* unset promiscuous mode, if necessary */
-  iface_request.ifr_flags = old_eth_flags;
-  if ((ioctl(fd, SIOCSIFFLAGS, &iface_request)) < 0) {
-    perror("done_socket: ioctl(set)");
-    close(fd);
-    exit(-1);
+  for (;;) {
+    if (quit || draining) {
+      if (!draining)
+        fprintf(stderr, "signal %d received, reading what is left\n", (int)quit);
+      draining = true;
+      for (; drain_at < ninterfaces; drain_at++, drained = 0)
+        if (drained < DRAIN_MAX
+            && (n = receive(&interfaces[drain_at], frame)) > 0) {
+          drained++;
+          *ifc = &interfaces[drain_at];
+          return n;
+        }
+      close(ep);
+      return 0;
+    }
+    if (pos < nready && ready[pos].data.u32 == WAKE_EVENT) {
+      uint64_t n;
+      if (read(wake_fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        perror("read");
+      pos++;
+      return -1;
+    }
+    if (pos < nready) {
+      Interface *i = &interfaces[ready[pos].data.u32];
+      if (budget-- > 0 && (n = receive(i, frame)) > 0) {
+        *ifc = i;
+        return n;
+      }
+      pos++;
+      budget = READ_BATCH;
+      continue;
+    }
+    if ((n = epoll_wait(ep, ready, MAX_INTERFACES + 1, timeout)) < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      return 0;
+    }
+    if (n == 0) {
+      if (timeout != 0) return 0;  /* idle for too long */
+      /* everything is read: send output on while we wait */
+      if (pipeline) pipeline->flush();
+      f->flush();
+      timeout = idle > 0 ? idle * 1000 : -1;
+      continue;
+    }
+    nready = n;
+    pos = 0;
+    budget = READ_BATCH;
+    timeout = 0;
   }
+}
 
-  close(fd);
+/* only notes the signal: next_frame() says so, and drains the sockets */
+void die(int sig) {
+  quit = sig;
 }
 
-void die(int ignored) {
-  quit = 1;
-#ifdef DEBUG
-  printf("signal %d received, aborting.\n", ignored);
-#endif
+/* SIGUSR1 */
+void dump_signal(int ignored) {
+  int saved = errno;
+  dump_wanted = DUMP_SIGNAL;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0) {
+    /* the counter is full: a wakeup is pending anyway */
+  }
+  errno = saved;
+}
+
+/* /dump on the metrics server: the capture loop writes the file */
+static void dump_page(FILE *fp, void *arg) {
+  dump_wanted = DUMP_REQUEST;
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0)
+    fprintf(fp, "dump failed: %s\n", strerror(errno));
+  else
+    fprintf(fp, "dump requested\n");
 }
@@ -29,7 +29,7 @@
 #include "tcppacket.h"
 #include "token.h"
 
-static Flag flag_map[] = {
+Flag tcp_flag_map[] = {
 	{ 32, "URG" },
 	{ 16, "ACK" },
 	{ 8, "PSH" },
@@ -92,25 +92,19 @@ Buffer TCPPacket::to_buffer(void) const {
 	return ret;
 }
 
-void TCPPacket::print(FILE *fp) const {
-	fprintf(fp, "TCP(sport=%d dport=%d", sport, dport);
-	if (seq) fprintf(fp, " seq=%u", seq);
-	if (ack) fprintf(fp, " ack=%u", ack);
-	if (hlen != 5) fprintf(fp, " header_length=%d", hlen);
-	if (flags) {
-		fprintf(fp, " flags=");
-		print_flags(fp, flags, flag_map);
-	}
-	if (window) fprintf(fp, " window=%d", window);
+void TCPPacket::format(Formatter &f) const {
+	f.begin("TCP");
+	f.field("sport", sport);
+	f.field("dport", dport);
+	f.field("seq", seq, seq != 0);
+	f.field("ack", ack, ack != 0);
+	f.field("header_length", hlen, hlen != 5);
+	f.field_flags("flags", flags, tcp_flag_map, flags != 0);
+	f.field("window", window, window != 0);
 	/* print checksum if wrong */
-	if (flags & TCP_FLAG_URG) fprintf(fp, " urg=%d", urg);
-	if (data.length > 0) {
-		fprintf(fp, " data=(");
-		for (int i=0; i<data.length; i++)
-			fprintf(fp, "%02x", data.data[i]);
-		fprintf(fp, ")");
-	}
-	fprintf(fp, ")");
+	f.field("urg", urg, flags & TCP_FLAG_URG);
+	f.field_data("data", data.data, data.length, data.length > 0);
+	f.end();
 }
 
 int TCPPacket::get_length(void) const {
@@ -130,7 +124,7 @@ void TCPPacket::set_field(const char *name, const char *value) {
 		if (isdigit((int)value[0]))
 			flags = parse_number(value);
 		else
-			flags = parse_flags(value, flag_map);
+			flags = parse_flags(value, tcp_flag_map);
 	}
 	else if (!strcasecmp(name, "window")) window = parse_number(value);
 	else if (!strcasecmp(name, "checksum")) checksum = parse_number(value);
@@ -24,6 +24,7 @@
 #define TCPPACKET_H
 
 #include "buffer.h"
+#include "flags.h"
 #include "packet.h"
 
 class TCPPacket : public Packet {
@@ -31,7 +32,7 @@ public:
 	TCPPacket(void);
 	TCPPacket(const Buffer &b);
 	virtual Buffer to_buffer(void) const;
-	virtual void print(FILE *fp) const;
+	virtual void format(Formatter &f) const;
 	virtual int get_length(void) const;
 	virtual void set_field(const char *name, const char *value);
 	virtual void set_data(const Buffer &b);
@@ -46,5 +47,6 @@ public:
 
 enum { TCP_FLAG_FIN=1, TCP_FLAG_SYN=2, TCP_FLAG_RST=4, TCP_FLAG_PSH=8,
 	TCP_FLAG_ACK=16, TCP_FLAG_URG=32 };
+extern Flag tcp_flag_map[];
 
 #endif
@@ -20,11 +20,16 @@
  * 02111-1307, USA.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <glib.h>
+#include "token.h"
 
 GString *next_token(FILE *fp, const char *skip, const char *end) {
 	char c = '\0';
@@ -58,3 +63,85 @@ unsigned int parse_number(const char *string) {
 	else
 		return strtoul(string, NULL, 10);
 }
+
+static unsigned char char_class[256];
+
+static void init_char_class(void) {
+	char_class[(unsigned char)' '] = TOK_SPACE;
+	char_class[(unsigned char)'\t'] = TOK_SPACE;
+	char_class[(unsigned char)'\r'] = TOK_SPACE;
+	char_class[(unsigned char)'\n'] = TOK_SPACE;
+	char_class[(unsigned char)'('] = TOK_OPEN;
+	char_class[(unsigned char)')'] = TOK_CLOSE;
+	char_class[(unsigned char)'='] = TOK_EQUALS;
+}
+
+SpecFile::SpecFile(const char *filename) {
+	struct stat st;
+	int fd;
+
+	if (!char_class[(unsigned char)'(']) init_char_class();
+	base = pos = limit = NULL;
+	size = 0;
+	mapped = false;
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		perror(filename);
+		return;
+	}
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		size = st.st_size;
+		if (size == 0)
+			base = "";
+		else {
+			void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				madvise(p, size, MADV_SEQUENTIAL);
+				base = (const char*)p;
+				mapped = true;
+			}
+		}
+	}
+	if (!base) {
+		/* not mappable (a pipe, say): read it all in instead */
+		char *buf = NULL;
+		size_t alloc = 0;
+		ssize_t n;
+		size = 0;
+		do {
+			if (size == alloc) {
+				alloc = alloc ? alloc*2 : 65536;
+				buf = (char*)g_realloc(buf, alloc);
+			}
+			n = read(fd, buf+size, alloc-size);
+			if (n > 0) size += n;
+		} while (n > 0);
+		if (n < 0)
+			perror(filename);
+		if (n < 0 || size == 0) {
+			g_free(buf);
+			if (n == 0) base = "";
+		}
+		else
+			base = buf;
+	}
+	close(fd);
+	pos = base;
+	limit = base ? base + size : NULL;
+}
+
+SpecFile::~SpecFile(void) {
+	if (mapped)
+		munmap((void*)base, size);
+	else if (base && size > 0)
+		g_free((void*)base);
+}
+
+Token SpecFile::next_token(int skip, int end, bool consume) {
+	Token t;
+	while (pos < limit && (char_class[(unsigned char)*pos] & skip)) pos++;
+	t.str = pos;
+	while (pos < limit && !(char_class[(unsigned char)*pos] & end)) pos++;
+	t.len = pos - t.str;
+	if (consume && pos < limit) pos++;
+	return t;
+}
@@ -29,4 +29,34 @@
 GString *next_token(FILE *fp, const char *skip, const char *end);
 unsigned int parse_number(const char *string);
 
+/* character classes for SpecFile::next_token() */
+enum { TOK_SPACE=1, TOK_OPEN=2, TOK_CLOSE=4, TOK_EQUALS=8 };
+
+/* A view into a SpecFile's contents; not NUL-terminated. */
+struct Token {
+	const char *str;
+	int len;
+};
+
+/* A spec file mapped into memory and tokenized in place: tokens point
+ * into the mapping, so nothing is allocated per token. */
+class SpecFile {
+public:
+	SpecFile(const char *filename);
+	~SpecFile(void);
+	bool ok(void) const { return base != NULL; }
+	bool at_end(void) const { return pos >= limit; }
+	int peek(void) const { return pos < limit ? (unsigned char)*pos : EOF; }
+	void skip(void) { if (pos < limit) pos++; }
+	/* Skip characters in the 'skip' classes, then return everything up to
+	 * the first character in the 'end' classes, which is consumed too if
+	 * 'consume' is set. */
+	Token next_token(int skip, int end, bool consume);
+
+private:
+	const char *base, *pos, *limit;
+	size_t size;
+	bool mapped;
+};
+
 #endif
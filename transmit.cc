@@ -0,0 +1,431 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/if_packet.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <glib.h>
+#include "ippacket.h"
+#include "transmit.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#define RING_FRAME_SIZE 2048
+#define RING_FRAME_COUNT 4096
+#define RING_BLOCK_SIZE (RING_FRAME_SIZE*32)
+
+/* where the Ethernet header starts in a TPACKET_V2 transmit frame */
+#define RING_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+/* the kernel's cap on datagrams per UDP_SEGMENT send, and on its size */
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65507
+#define GSO_HASH_SIZE (2*GSO_MAX_FLOWS)
+
+static int make_raw_socket(void) {
+	int fd;
+	if ((fd = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
+		perror("raw socket");
+		exit(1);
+	}
+	return fd;
+}
+
+RawTransmitter::RawTransmitter(void) {
+	fd = make_raw_socket();
+}
+
+RawTransmitter::~RawTransmitter(void) {
+	close(fd);
+}
+
+bool RawTransmitter::send(const unsigned char *data, int len,
+		struct in_addr dst, int port) {
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = port;
+	sin.sin_addr = dst;
+	if (sendto(fd, data, len, 0, (struct sockaddr*)&sin, sizeof(sin)) == -1) {
+		perror("sendto");
+		errors++;
+		return false;
+	}
+	packets++;
+	bytes += len;
+	return true;
+}
+
+RingTransmitter::RingTransmitter(const char *device,
+		const unsigned char *dest_mac, int batch) {
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	struct tpacket_req req;
+	int version = TPACKET_V2;
+
+	this->batch = batch > 0 ? batch : 1;
+	frame_size = RING_FRAME_SIZE;
+	frame_count = RING_FRAME_COUNT;
+	head = 0;
+	pending = 0;
+
+	/* protocol 0: transmit only, never queue received frames here */
+	if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+		perror("packet socket");
+		exit(1);
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		perror(device);
+		exit(1);
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = ifr.ifr_ifindex;
+
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("ioctl(SIOCGIFHWADDR)");
+		exit(1);
+	}
+	memcpy(ether, dest_mac, 6);
+	memcpy(ether+6, ifr.ifr_hwaddr.sa_data, 6);
+	ether[12] = ETH_P_IP >> 8;
+	ether[13] = ETH_P_IP & 0xFF;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+			sizeof(version)) < 0) {
+		perror("setsockopt(PACKET_VERSION)");
+		exit(1);
+	}
+	req.tp_frame_size = frame_size;
+	req.tp_frame_nr = frame_count;
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = frame_count * frame_size / RING_BLOCK_SIZE;
+	if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		perror("setsockopt(PACKET_TX_RING)");
+		exit(1);
+	}
+	ring = (unsigned char*)mmap(NULL, frame_count * frame_size,
+		PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	if (bind(fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+}
+
+RingTransmitter::~RingTransmitter(void) {
+	flush();
+	munmap(ring, frame_count * frame_size);
+	close(fd);
+}
+
+/* Wait until the frame at 'head' is ours again. */
+void RingTransmitter::reap(void) {
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr*)(ring + head*frame_size);
+	for (;;) {
+		unsigned int status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+		if (status == TP_STATUS_AVAILABLE) return;
+		if (status == TP_STATUS_WRONG_FORMAT) {
+			errors++;
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_AVAILABLE,
+				__ATOMIC_RELEASE);
+			return;
+		}
+		if (pending > 0) {
+			flush();
+			continue;
+		}
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 100) < 0 && errno != EINTR) {
+			perror("poll");
+			return;
+		}
+	}
+}
+
+bool RingTransmitter::send(const unsigned char *data, int len,
+		struct in_addr dst, int port) {
+	if (len + sizeof(ether) > frame_size - RING_DATA_OFFSET) {
+		g_warning("TX ring: %d-byte datagram does not fit in a frame", len);
+		errors++;
+		return false;
+	}
+	reap();
+
+	unsigned char *frame = ring + head*frame_size;
+	struct tpacket2_hdr *hdr = (struct tpacket2_hdr*)frame;
+	memcpy(frame + RING_DATA_OFFSET, ether, sizeof(ether));
+	memcpy(frame + RING_DATA_OFFSET + sizeof(ether), data, len);
+	hdr->tp_len = len + sizeof(ether);
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+	head = (head + 1) % frame_count;
+	packets++;
+	bytes += len;
+	if (++pending >= batch) flush();
+	return true;
+}
+
+void RingTransmitter::flush(void) {
+	if (pending == 0) return;
+	/* a blocking send() with no data drains every SEND_REQUEST frame */
+	while (::send(fd, NULL, 0, 0) < 0) {
+		if (errno == EINTR) continue;
+		perror("send");
+		errors++;
+		break;
+	}
+	pending = 0;
+}
+
+GSOTransmitter::GSOTransmitter(int segments, int stamp) {
+	this->segments = MAX(1, MIN(segments, GSO_MAX_SEGMENTS));
+	this->stamp = stamp;
+	flows = g_new(Flow, GSO_MAX_FLOWS);
+	buckets = g_new(int, GSO_HASH_SIZE);
+	for (int i=0; i<GSO_HASH_SIZE; i++) buckets[i] = -1;
+	nflows = 0;
+	newest = oldest = -1;
+	evictions = 0;
+	warned = false;
+}
+
+GSOTransmitter::~GSOTransmitter(void) {
+	flush();
+	for (int i=0; i<nflows; i++) {
+		close(flows[i].fd);
+		g_free(flows[i].buf);
+	}
+	g_free(flows);
+	g_free(buckets);
+}
+
+static unsigned int flow_bucket(const unsigned char *key) {
+	unsigned int a, b, c;
+	memcpy(&a, key, 4);
+	memcpy(&b, key+4, 4);
+	memcpy(&c, key+8, 4);
+	unsigned long long x = (((unsigned long long)a << 32) | b) * 0x9E3779B97F4A7C15ULL ^ c;
+	x *= 0xff51afd7ed558ccdULL;
+	return (x >> 32) & (GSO_HASH_SIZE - 1);
+}
+
+/* take flow i out of the use order */
+void GSOTransmitter::unlink(int i) {
+	Flow *f = &flows[i];
+	if (f->newer >= 0) flows[f->newer].older = f->older;
+	else newest = f->older;
+	if (f->older >= 0) flows[f->older].newer = f->newer;
+	else oldest = f->newer;
+}
+
+/* Flush and close flow i and take it out of its hash chain, leaving the
+ * slot (and its buffer) to be reused. */
+void GSOTransmitter::evict(int i) {
+	Flow *f = &flows[i];
+	flush_flow(f);
+	close(f->fd);
+	int *p = &buckets[flow_bucket(f->key)];
+	while (*p != i) p = &flows[*p].chain;
+	*p = f->chain;
+	unlink(i);
+	evictions++;
+}
+
+/* Find the socket for this flow, opening one the first time it's seen:
+ * bound to the spec's source address and port where the host allows it,
+ * and connected to its destination. */
+GSOTransmitter::Flow *GSOTransmitter::find_flow(const unsigned char *ip,
+		const unsigned char *udp) {
+	unsigned char key[12];
+	memcpy(key, ip+12, 8);
+	memcpy(key+8, udp, 4);
+	if (newest >= 0 && !memcmp(flows[newest].key, key, sizeof(key)))
+		return &flows[newest];
+	unsigned int h = flow_bucket(key);
+	for (int i=buckets[h]; i>=0; i=flows[i].chain)
+		if (!memcmp(flows[i].key, key, sizeof(key))) {
+			unlink(i);
+			flows[i].older = newest;
+			flows[i].newer = -1;
+			flows[newest].newer = i;
+			newest = i;
+			return &flows[i];
+		}
+
+	struct sockaddr_in sin;
+	int fd;
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		perror("udp socket");
+		return NULL;
+	}
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	memcpy(&sin.sin_port, udp, 2);
+	memcpy(&sin.sin_addr, ip+12, 4);
+	if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+		sin.sin_addr.s_addr = INADDR_ANY;
+		if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+			g_warning("GSO: could not bind source port %d, using any",
+				(udp[0]<<8) + udp[1]);
+	}
+	memcpy(&sin.sin_port, udp+2, 2);
+	memcpy(&sin.sin_addr, ip+16, 4);
+	if (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+		perror("connect");
+		close(fd);
+		return NULL;
+	}
+
+	int i;
+	if (nflows < GSO_MAX_FLOWS) {
+		i = nflows++;
+		flows[i].buf = g_new(unsigned char, GSO_MAX_BYTES);
+	}
+	else {
+		i = oldest;
+		evict(i);
+	}
+	Flow *f = &flows[i];
+	memcpy(f->key, key, sizeof(key));
+	f->fd = fd;
+	f->size = -1;
+	f->max = 1;
+	f->queued = 0;
+	f->seq = 0;
+	f->chain = buckets[h];
+	buckets[h] = i;
+	f->older = newest;
+	f->newer = -1;
+	if (newest >= 0) flows[newest].newer = i;
+	else oldest = i;
+	newest = i;
+	return f;
+}
+
+static void put64(unsigned char *p, unsigned long long v) {
+	for (int i=7; i>=0; i--) {
+		p[i] = v & 0xFF;
+		v >>= 8;
+	}
+}
+
+bool GSOTransmitter::send(const unsigned char *data, int len,
+		struct in_addr dst, int port) {
+	if (len < 28 || (data[0] >> 4) != 4 || data[9] != IP_UDP
+			|| len < (data[0] & 0x0F)*4 + 8) {
+		if (!warned) g_warning("GSO: can only send UDP datagrams");
+		warned = true;
+		errors++;
+		return false;
+	}
+	const unsigned char *udp = data + (data[0] & 0x0F)*4;
+	int size = len - (udp - data) - 8;
+	Flow *f = find_flow(data, udp);
+	if (!f) {
+		errors++;
+		return false;
+	}
+
+	if (size != f->size) {
+		flush_flow(f);
+		f->size = size;
+		f->max = size > 0 ? MAX(1, MIN(segments, GSO_MAX_BYTES / size)) : 1;
+		if (size > 0 && setsockopt(f->fd, SOL_UDP, UDP_SEGMENT, &size,
+				sizeof(size)) < 0) {
+			perror("setsockopt(UDP_SEGMENT)");
+			f->max = 1;
+		}
+	}
+
+	unsigned char *seg = f->buf + f->queued * size;
+	memcpy(seg, udp+8, size);
+	int off = 0;
+	if ((stamp & STAMP_SEQ) && size >= off+8) {
+		put64(seg+off, f->seq);
+		off += 8;
+	}
+	if ((stamp & STAMP_TIME) && size >= off+8) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		put64(seg+off, (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+	}
+	f->seq++;
+	if (++f->queued >= f->max) return flush_flow(f);
+	return true;
+}
+
+bool GSOTransmitter::flush_flow(Flow *f) {
+	int n = f->queued;
+	if (n == 0) return true;
+	f->queued = 0;
+	if (::send(f->fd, f->buf, n * f->size, 0) < 0) {
+		if (!warned) perror("send");
+		warned = true;
+		errors += n;
+		return false;
+	}
+	packets += n;
+	bytes += (unsigned long long)n * (f->size + 28);
+	return true;
+}
+
+void GSOTransmitter::flush(void) {
+	for (int i=0; i<nflows; i++)
+		flush_flow(&flows[i]);
+}
+
+bool parse_mac(const char *s, unsigned char *mac) {
+	unsigned int m[6];
+	if (sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4],
+			&m[5]) != 6)
+		return false;
+	for (int i=0; i<6; i++) {
+		if (m[i] > 0xFF) return false;
+		mac[i] = m[i];
+	}
+	return true;
+}
@@ -0,0 +1,122 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef TRANSMIT_H
+#define TRANSMIT_H
+
+#include <netinet/in.h>
+
+/* A place to put finished IP datagrams.  send() may queue; flush()
+ * pushes anything queued out to the wire. */
+class Transmitter {
+public:
+	virtual ~Transmitter(void) { }
+	virtual bool send(const unsigned char *data, int len, struct in_addr dst,
+		int port) = 0;
+	virtual void flush(void) { }
+
+	unsigned long packets, bytes, errors;
+
+protected:
+	Transmitter(void) { packets = bytes = errors = 0; }
+};
+
+/* One sendto() per datagram through an IPPROTO_RAW socket. */
+class RawTransmitter : public Transmitter {
+public:
+	RawTransmitter(void);
+	~RawTransmitter(void);
+	virtual bool send(const unsigned char *data, int len, struct in_addr dst,
+		int port);
+
+private:
+	int fd;
+};
+
+/* AF_PACKET socket with a PACKET_TX_RING.  Datagrams are written straight
+ * into ring frames behind a synthesized Ethernet header, and the kernel is
+ * kicked with one send() per 'batch' frames. */
+class RingTransmitter : public Transmitter {
+public:
+	RingTransmitter(const char *device, const unsigned char *dest_mac,
+		int batch);
+	~RingTransmitter(void);
+	virtual bool send(const unsigned char *data, int len, struct in_addr dst,
+		int port);
+	virtual void flush(void);
+
+private:
+	void reap(void);
+
+	int fd, batch, pending;
+	unsigned char *ring;
+	unsigned int frame_size, frame_count, head;
+	unsigned char ether[14];
+};
+
+/* Stamps GSOTransmitter can write into the front of each datagram's
+ * payload: a per-flow 64-bit sequence number and/or a 64-bit
+ * CLOCK_REALTIME nanosecond timestamp, both big-endian, in that order. */
+enum { STAMP_SEQ=1, STAMP_TIME=2 };
+
+/* Ordinary UDP sockets with UDP_SEGMENT: consecutive datagrams of a flow
+ * are queued back to back and handed to the kernel in one send of up to
+ * 'segments' datagrams, which it splits on the way out.  Only UDP
+ * datagrams are accepted; their IP and UDP headers pick the flow.  At
+ * most GSO_MAX_FLOWS flows are open at once, each with a socket and a
+ * 64 KB buffer; past that the least recently used one is flushed and
+ * closed, and starts again from sequence number 0 if it comes back. */
+#define GSO_MAX_FLOWS 256
+
+class GSOTransmitter : public Transmitter {
+public:
+	GSOTransmitter(int segments, int stamp);
+	~GSOTransmitter(void);
+	virtual bool send(const unsigned char *data, int len, struct in_addr dst,
+		int port);
+	virtual void flush(void);
+
+	unsigned long evictions;  /* flows closed to make room for new ones */
+
+private:
+	struct Flow {
+		unsigned char key[12];  /* src, dst, sport, dport as on the wire */
+		int fd, size, max, queued;
+		unsigned long long seq;
+		unsigned char *buf;
+		int chain;         /* next flow in the same hash bucket, or -1 */
+		int newer, older;  /* neighbours in use order, or -1 */
+	};
+	Flow *find_flow(const unsigned char *ip, const unsigned char *udp);
+	bool flush_flow(Flow *f);
+	void unlink(int i);
+	void evict(int i);
+
+	Flow *flows;      /* GSO_MAX_FLOWS slots, nflows of them in use */
+	int *buckets;     /* GSO_HASH_SIZE chain heads, or -1 */
+	int nflows, newest, oldest, segments, stamp;
+	bool warned;
+};
+
+bool parse_mac(const char *s, unsigned char *mac);
+
+#endif
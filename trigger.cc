@@ -0,0 +1,337 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "ether.h"
+#include "trigger.h"
+
+Trigger::Trigger(void) {
+	rate = 0;
+	rate_window = 1000000000LL;
+	window_start = 0;
+	this_window = last_window = 0;
+	pre = TRIGGER_PRE * 1000000000LL;
+	post = TRIGGER_POST * 1000000000LL;
+	post_packets = 0;
+	stop_at = 0;
+	left = 0;
+	prefix = g_strdup("trigger");
+	firing = false;
+	history = spare = NULL;
+	cur = queue = queue_tail = free_list = NULL;
+	chunks = 0;
+	running = closing = false;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	fires = matches = written = lost = 0;
+}
+
+Trigger::~Trigger(void) {
+	stop();
+	if (running) {
+		pthread_mutex_lock(&lock);
+		closing = true;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+		pthread_join(writer, NULL);
+	}
+	while (free_list) {
+		Job *j = free_list;
+		free_list = j->next;
+		g_free(j->data);
+		g_free(j);
+	}
+	pthread_mutex_destroy(&lock);
+	pthread_cond_destroy(&wake);
+	delete history;
+	delete spare;
+	g_free(prefix);
+}
+
+/* s without leading or trailing spaces, in place */
+static char *trim(char *s) {
+	while (*s == ' ') s++;
+	int n = strlen(s);
+	while (n > 0 && s[n-1] == ' ') s[--n] = '\0';
+	return s;
+}
+
+bool Trigger::parse(const char *spec) {
+	char *copy = g_strdup(spec), *save;
+	char *part = strtok_r(copy, ";", &save);
+	bool ok = part && filter.compile(part);
+	while (ok && (part = strtok_r(NULL, ";", &save))) {
+		char *value = strchr(part, '='), *end;
+		if (!value) {
+			fprintf(stderr, "trigger: bad clause \"%s\"\n", trim(part));
+			ok = false;
+			break;
+		}
+		*value++ = '\0';
+		char *key = trim(part);
+		if (!strcmp(key, "rate")) {
+			rate = strtol(value, &end, 10);
+			long secs = *end == '/' ? strtol(end + 1, &end, 10) : 1;
+			ok = rate > 0 && secs > 0;
+			rate_window = secs * 1000000000LL;
+		}
+		else if (!strcmp(key, "pre")) {
+			long secs = strtol(value, &end, 10);
+			ok = end != value && secs >= 0;
+			pre = secs * 1000000000LL;
+		}
+		else if (!strcmp(key, "post")) {
+			long n = strtol(value, &end, 10);
+			ok = end != value && n > 0;
+			if (*end == 'p') {
+				post_packets = n;
+				end++;
+			}
+			else
+				post = n * 1000000000LL;
+		}
+		else if (!strcmp(key, "out")) {
+			g_free(prefix);
+			prefix = g_strdup(trim(value));
+			end = value + strlen(value);
+			ok = *prefix != '\0';
+		}
+		else
+			ok = false;
+		while (ok && *end == ' ') end++;
+		if (!ok || *end) {
+			fprintf(stderr, "trigger: bad clause \"%s=%s\"\n", key, value);
+			ok = false;
+		}
+	}
+	g_free(copy);
+	if (!ok) return false;
+	if (pre > 0) {
+		history = new FlightRecorder(pre / 1000000000LL, TRIGGER_MB, prefix,
+			false);
+		spare = new FlightRecorder(pre / 1000000000LL, TRIGGER_MB, prefix,
+			false);
+	}
+	if (pthread_create(&writer, NULL, write_thread, this)) {
+		perror("pthread_create");
+		return false;
+	}
+	running = true;
+	return true;
+}
+
+/* count a match; true if the rate, if there is one, is exceeded */
+bool Trigger::hit(long long ts) {
+	if (rate == 0) return true;
+	long long age = ts - window_start;
+	if (age >= rate_window) {
+		last_window = age < 2 * rate_window ? this_window : 0;
+		window_start = ts - age % rate_window;
+		this_window = 0;
+		age = ts - window_start;
+	}
+	this_window++;
+	double overlap = 1.0 - (double)age / rate_window;
+	return this_window + last_window * overlap > rate;
+}
+
+void Trigger::submit(Job *j) {
+	j->next = NULL;
+	pthread_mutex_lock(&lock);
+	if (queue_tail)
+		queue_tail->next = j;
+	else
+		queue = j;
+	queue_tail = j;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+}
+
+/* copy a frame into the buffer being filled; false if there is no buffer
+ * to be had */
+bool Trigger::save(long long ts, const unsigned char *frame, int caplen,
+		int len) {
+	if (caplen > RECORDER_MAX_FRAME) caplen = RECORDER_MAX_FRAME;
+	int need = sizeof(Record) + caplen;
+	if (cur && cur->used + need > TRIGGER_CHUNK) {
+		submit(cur);
+		cur = NULL;
+	}
+	if (!cur) {
+		pthread_mutex_lock(&lock);
+		if (free_list) {
+			cur = free_list;
+			free_list = cur->next;
+		}
+		pthread_mutex_unlock(&lock);
+		if (!cur && chunks < TRIGGER_CHUNKS) {
+			cur = g_new(Job, 1);
+			cur->kind = Job::FRAMES;
+			cur->data = g_new(unsigned char, TRIGGER_CHUNK);
+			chunks++;
+		}
+		if (!cur) return false;
+		cur->used = 0;
+	}
+	Record r;
+	r.ts = ts;
+	r.caplen = caplen;
+	r.len = len;
+	memcpy(cur->data + cur->used, &r, sizeof(r));
+	memcpy(cur->data + cur->used + sizeof(r), frame, caplen);
+	cur->used += need;
+	return true;
+}
+
+void Trigger::frame(long long ts, const unsigned char *frame, int caplen,
+		int len) {
+	EtherFrame ef;
+	unsigned int v[NFIELDS];
+	bool match = ether_classify(frame, caplen, &ef) == ETHER_IPV4
+		&& (ef.payload[0] >> 4) == 4 && datagram_fields(ef.payload, ef.length, v)
+		&& filter.match(v);
+	bool fire = false;
+	if (match) {
+		matches++;
+		fire = hit(ts);
+	}
+
+	if (!firing && fire) {
+		Job *j = g_new(Job, 1);
+		j->kind = Job::OPEN;
+		j->name = FlightRecorder::file_name(prefix, ++fires);
+		j->history = NULL;
+		/* the history goes to the writer whole, if the last one is back */
+		pthread_mutex_lock(&lock);
+		FlightRecorder *empty = spare;
+		spare = NULL;
+		pthread_mutex_unlock(&lock);
+		if (empty) {
+			j->history = history;
+			written += history->frames;
+			history = empty;
+		}
+		submit(j);
+		firing = true;
+	}
+	if (!firing) {
+		if (history) history->add(ts, frame, caplen, len);
+		return;
+	}
+
+	if (save(ts, frame, caplen, len))
+		written++;
+	else
+		lost++;
+	if (fire) {
+		stop_at = ts + post;
+		left = post_packets;
+	}
+	else if (post_packets > 0 ? --left <= 0 : ts >= stop_at)
+		stop();
+}
+
+void Trigger::stop(void) {
+	if (!firing) return;
+	if (cur) {
+		submit(cur);
+		cur = NULL;
+	}
+	Job *j = g_new(Job, 1);
+	j->kind = Job::CLOSE;
+	submit(j);
+	firing = false;
+}
+
+/* writes the files; FRAMES buffers go back on the free list, and a
+ * history recorder back as the spare, once they are written */
+void *Trigger::write_thread(void *arg) {
+	Trigger *t = (Trigger *)arg;
+	PcapWriter *out = NULL;
+	for (;;) {
+		pthread_mutex_lock(&t->lock);
+		while (!t->queue && !t->closing)
+			pthread_cond_wait(&t->wake, &t->lock);
+		Job *j = t->queue;
+		if (j) {
+			t->queue = j->next;
+			if (!t->queue) t->queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&t->lock);
+		if (!j) break;  /* closing, and nothing left */
+
+		switch (j->kind) {
+			case Job::OPEN: {
+				out = new PcapWriter(j->name, LINK_ETHERNET, RECORDER_MAX_FRAME);
+				if (!out->ok()) {
+					delete out;
+					out = NULL;
+				}
+				unsigned long n = 0;
+				if (j->history) {
+					/* unwritten frames age out of it as it fills again */
+					if (out) n = j->history->drain(out);
+					pthread_mutex_lock(&t->lock);
+					t->spare = j->history;
+					pthread_mutex_unlock(&t->lock);
+				}
+				if (out)
+					fprintf(stderr, "trigger: writing %s, from %lu frames before\n",
+						j->name, n);
+				g_free(j->name);
+				g_free(j);
+				break;
+			}
+			case Job::FRAMES:
+				for (int pos = 0; out && pos < j->used; ) {
+					Record r;
+					memcpy(&r, j->data + pos, sizeof(r));
+					out->write(r.ts, j->data + pos + sizeof(r), r.caplen, r.len);
+					pos += sizeof(r) + r.caplen;
+				}
+				pthread_mutex_lock(&t->lock);
+				j->next = t->free_list;
+				t->free_list = j;
+				pthread_mutex_unlock(&t->lock);
+				break;
+			case Job::CLOSE:
+				if (out) {
+					fprintf(stderr, "trigger: stopped after %lu frames\n", out->records);
+					delete out;
+					out = NULL;
+				}
+				g_free(j);
+				break;
+		}
+	}
+	delete out;
+	return NULL;
+}
+
+void Trigger::report(FILE *fp) const {
+	fprintf(fp, "trigger: %lu frames matched, fired %lu times, %lu frames written",
+		matches, fires, written);
+	if (lost) fprintf(fp, ", %lu lost with the disk behind", lost);
+	fputc('\n', fp);
+}
@@ -0,0 +1,121 @@
+/* PacketKit - sniffer, packet generator, and GUI for Linux
+ * Copyright (C) 2001 by Patrick Reynolds
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License
+ * along with this library; if not, write to the Free
+ * Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "filter.h"
+#include "pcap.h"
+#include "recorder.h"
+
+/* Captures around an event, for automated incident capture.  A trigger
+ * is a filter (see filter.h) and some clauses, separated by semicolons:
+ *   rate=N/SECS  fire only while more than N packets a SECS seconds match
+ *   pre=SECS     start the file with the SECS seconds before firing
+ *                (default 5)
+ *   post=SECS    stop SECS seconds after the last match (default 10),
+ *   post=Np      or N packets after it
+ *   out=PREFIX   name files PREFIX-TIME-N.pcap (default "trigger")
+ * e.g. "flags RST;rate=100/1;post=30" or "icmptype = 3;pre=2;post=500p".
+ *
+ * Every frame is tested as it arrives, on fields read straight from the
+ * frame, and the rate is a sliding-window estimate from two counters
+ * (this window's matches, plus last window's scaled by how much of it
+ * still overlaps), so the cost per frame and the memory are fixed.  The
+ * history before firing is a FlightRecorder.  Nothing is written on the
+ * capturing thread: on firing, the history is handed whole to a writer
+ * thread and a second recorder takes its place, and while the trigger is
+ * firing frames are copied into TRIGGER_CHUNK buffers queued for the
+ * writer.  If the disk falls TRIGGER_CHUNKS buffers behind, frames are
+ * left out of the file and counted as lost rather than holding up
+ * capture; if the trigger fires again before the last history is
+ * written, the new file starts without one. */
+
+#define TRIGGER_PRE 5
+#define TRIGGER_POST 10
+#define TRIGGER_MB 64
+#define TRIGGER_CHUNK (1 << 20)
+#define TRIGGER_CHUNKS 64
+
+class Trigger {
+public:
+	Trigger(void);
+	~Trigger(void);
+	bool parse(const char *spec);  /* warns and returns false on error */
+	/* every frame, in order; ts in nanoseconds */
+	void frame(long long ts, const unsigned char *frame, int caplen, int len);
+	/* close the file being written, if any */
+	void stop(void);
+	void report(FILE *fp) const;
+
+	bool active(void) const { return firing; }
+	unsigned long fires;    /* files started */
+	unsigned long matches;  /* frames matching the filter */
+	unsigned long written;  /* frames handed to the writer, history included */
+	unsigned long lost;     /* frames left out: the writer was behind */
+
+private:
+	/* work for the writer thread, done in order */
+	struct Job {
+		enum { OPEN, FRAMES, CLOSE } kind;
+		char *name;               /* OPEN: the file to start */
+		FlightRecorder *history;  /* OPEN: frames from before, or NULL */
+		unsigned char *data;      /* FRAMES: a Record, then the frame, ... */
+		int used;
+		Job *next;
+	};
+	struct Record {
+		long long ts;
+		int caplen, len;
+	};
+	bool hit(long long ts);
+	void submit(Job *j);
+	bool save(long long ts, const unsigned char *frame, int caplen, int len);
+	static void *write_thread(void *arg);
+
+	Filter filter;
+	int rate;             /* matches per window to fire; 0: fire on any */
+	long long rate_window;
+	long long window_start;
+	unsigned long this_window, last_window;
+
+	long long pre, post;  /* ns */
+	long post_packets;    /* instead of post, if > 0 */
+	long long stop_at;
+	long left;
+	char *prefix;
+	bool firing;
+
+	/* spare is NULL while the writer has the other recorder */
+	FlightRecorder *history, *spare;
+	Job *cur;  /* FRAMES being filled */
+	Job *queue, *queue_tail, *free_list;
+	int chunks;  /* FRAMES buffers made */
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running, closing;
+};
+
+#endif
@@ -63,16 +63,14 @@ Buffer UDPPacket::to_buffer(void) const {
 	return ret;
 }
 
-void UDPPacket::print(FILE *fp) const {
-	fprintf(fp, "UDP(sport=%d dport=%d length=%d", sport, dport, length);
+void UDPPacket::format(Formatter &f) const {
+	f.begin("UDP");
+	f.field("sport", sport);
+	f.field("dport", dport);
+	f.field("length", length);
 	/* print the checksum if it's wrong */
-	if (data.length > 0) {
-		fprintf(fp, " data=(");
-		for (int i=0; i<data.length; i++)
-			fprintf(fp, "%02x", data.data[i]);
-		fprintf(fp, ")");
-	}
-	fprintf(fp, ")");
+	f.field_data("data", data.data, data.length, data.length > 0);
+	f.end();
 }
 
 int UDPPacket::get_length(void) const {